@@ -1,19 +1,69 @@
 #!/bin/bash
 
+# usage: ./build.sh [app|engine|runner|bench]
+#   app     the babbler app (macOS), default
+#   engine  static library of the headless rule engine
+#   runner  command line program runner, linked with the engine library
+#   bench   scalability benchmark of the engine, linked with the engine library
+
+TARGET=${1:-app}
+
 BINDIR=bin
-ORCA_DIR=$(orca sdk-path)
+ORCA_DIR=${ORCA_DIR:-$(orca sdk-path)}
 ORCA_LIB=$ORCA_DIR/bin
 ORCA_SRC=$ORCA_DIR/src
 
 
 INCLUDES="-I$ORCA_SRC"
 LIBS="-L$ORCA_LIB -lorca"
-FLAGS="-mmacos-version-min=10.15.4 -DOC_DEBUG -DLOG_COMPILE_DEBUG"
+FLAGS="-DOC_DEBUG -DLOG_COMPILE_DEBUG"
+
+#NOTE: the headless targets are also built on linux, where u64 isn't unsigned long long, so warnings are on
+WARNINGS="-Wall"
+
+if [ "$(uname)" = "Darwin" ]; then
+    FLAGS="-mmacos-version-min=10.15.4 $FLAGS"
+else
+    LIBS="$LIBS -lm -lpthread"
+fi
 
 mkdir -p $BINDIR
-clang -g $FLAGS $LIBS $INCLUDES -o $BINDIR/test src/main.c
 
-cp $ORCA_LIB/liborca.dylib $BINDIR/
-cp $ORCA_LIB/libwebgpu.dylib $BINDIR/
+build_engine() {
+    clang -g $OPT -c $WARNINGS $FLAGS $INCLUDES -o $BINDIR/engine.o src/engine.c || exit 1
+    ar rcs $BINDIR/libbabbler_engine.a $BINDIR/engine.o
+}
+
+case $TARGET in
+    app)
+        build_engine
+        clang -g $FLAGS $INCLUDES -o $BINDIR/test src/main.c -L$BINDIR -lbabbler_engine $LIBS || exit 1
+
+        cp $ORCA_LIB/liborca.dylib $BINDIR/
+        cp $ORCA_LIB/libwebgpu.dylib $BINDIR/
+
+        install_name_tool -add_rpath "@executable_path" $BINDIR/test
+        ;;
+
+    engine)
+        build_engine
+        ;;
+
+    runner)
+        build_engine
+        clang -g $WARNINGS $FLAGS $INCLUDES -o $BINDIR/runner src/runner.c -L$BINDIR -lbabbler_engine $LIBS
+        ;;
+
+    bench)
+        #NOTE: the benchmark is built optimized, and without debug checks
+        FLAGS="${FLAGS/-DOC_DEBUG/}"
+        OPT="-O2"
+        build_engine
+        clang -g $OPT $WARNINGS $FLAGS $INCLUDES -o $BINDIR/bench src/bench.c -L$BINDIR -lbabbler_engine $LIBS
+        ;;
 
-install_name_tool -add_rpath "@executable_path" $BINDIR/test
+    *)
+        echo "unknown target '$TARGET', expected app, engine, runner or bench"
+        exit 1
+        ;;
+esac
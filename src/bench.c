@@ -0,0 +1,379 @@
+/*************************************************************************
+*
+*  HMNJam24
+*  Copyright 2024 Martin Fouilleul
+*
+**************************************************************************/
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+//NOTE: scalability benchmark of the rule engine. Generates a table of synthetic cards, runs it for a number of
+//      frames while moving one card per frame, and prints the timings and sizes of each scenario as json.
+//
+//      Each card claims a few attributes and a group, derives a chain of stages from its first stage, and joins
+//      with the other cards of its group. On top of that, each scenario exercises one of the builtin listeners
+//      or responders: cards label themselves with their last stage, highlight the cards of their group, or
+//      point at their neighbours with whiskers.
+
+typedef enum
+{
+    BB_BENCH_LABELS,
+    BB_BENCH_HIGHLIGHTS,
+    BB_BENCH_POINTS,
+    BB_BENCH_SCENARIO_COUNT,
+} bb_bench_scenario;
+
+const char* BB_BENCH_SCENARIO_NAMES[BB_BENCH_SCENARIO_COUNT] = {
+    "labels",
+    "highlights",
+    "points",
+};
+
+typedef struct bb_bench_options
+{
+    u32 cardCount;
+    u32 claimCount;
+    u32 depth;
+    u32 fanOut;
+    u32 whiskerPercent;
+
+    u32 frameCount;
+    u32 workerCount;
+    bool incremental;
+
+} bb_bench_options;
+
+enum
+{
+    BB_BENCH_CARD_SIZE = 200,
+    BB_BENCH_CARD_SPACING = 250,
+    BB_BENCH_MOVE_STEP = 10,
+};
+
+oc_str8 bb_bench_card_program(oc_arena* arena, bb_bench_options* options, bb_bench_scenario scenario, u32 cardIndex)
+{
+    oc_str8_list list = { 0 };
+
+    for(u32 i = 0; i < options->claimCount; i++)
+    {
+        oc_str8_list_pushf(arena, &list, "(claim self attr %u)\n", i);
+    }
+
+    oc_str8_list_pushf(arena, &list, "(claim self stage 0 0)\n");
+    for(u32 i = 1; i <= options->depth; i++)
+    {
+        oc_str8_list_pushf(arena, &list, "(when (self stage %u $n) (claim self stage %u (+ n 1)))\n", i - 1, i);
+    }
+
+    oc_str8_list_pushf(arena, &list, "(claim self group %u)\n", cardIndex / oc_max(options->fanOut, 1));
+    oc_str8_list_pushf(arena, &list, "(when (self group $g) (when ($c group g) (claim self peer c)))\n");
+
+    switch(scenario)
+    {
+        case BB_BENCH_LABELS:
+            oc_str8_list_pushf(arena, &list, "(when (self stage %u $n) (wish self is labeled n))\n", options->depth);
+            break;
+
+        case BB_BENCH_HIGHLIGHTS:
+            oc_str8_list_pushf(arena, &list, "(when (self peer $p) (wish p is highlighted \"red\"))\n");
+            break;
+
+        case BB_BENCH_POINTS:
+            if((cardIndex % 100) < options->whiskerPercent)
+            {
+                const char* directions[4] = { "up", "left", "down", "right" };
+                oc_str8_list_pushf(arena,
+                                   &list,
+                                   "(when (self points %s at $q) (claim self sees q) (wish q is highlighted \"blue\"))\n",
+                                   directions[cardIndex % 4]);
+            }
+            break;
+
+        default:
+            break;
+    }
+    return (oc_str8_list_join(arena, list));
+}
+
+u64 bb_bench_arena_bytes(oc_arena* arena)
+{
+    u64 bytes = 0;
+    oc_list_for(arena->chunks, chunk, oc_arena_chunk, listElt)
+    {
+        bytes += chunk->offset;
+    }
+    return (bytes);
+}
+
+int bb_bench_compare_f64(const void* a, const void* b)
+{
+    f64 x = *(f64*)a;
+    f64 y = *(f64*)b;
+    return ((x > y) - (x < y));
+}
+
+f64 bb_bench_percentile(f64* sorted, u32 count, u32 percent)
+{
+    return (count ? sorted[(u64)(count - 1) * percent / 100] : 0);
+}
+
+bool bb_bench_run(bb_bench_options* options, bb_bench_scenario scenario, bool first)
+{
+    oc_arena arena = { 0 };
+    oc_arena_init(&arena);
+
+    bb_facts_db* factDb = calloc(1, sizeof(bb_facts_db));
+    factDb->frame = 2;
+    factDb->incremental = options->incremental;
+    factDb->workerCount = options->workerCount;
+    oc_arena_init(&factDb->persistentArena);
+
+    bb_program_init_builtin_listeners(&factDb->persistentArena, factDb);
+    bb_program_init_builtin_responders(&factDb->persistentArena, factDb);
+
+    u32 columnCount = 1;
+    while(columnCount * columnCount < options->cardCount)
+    {
+        columnCount++;
+    }
+
+    bb_card* cards = oc_arena_push_array(&arena, bb_card, options->cardCount);
+    memset(cards, 0, options->cardCount * sizeof(bb_card));
+
+    oc_list activeList = { 0 };
+
+    for(u32 cardIndex = 0; cardIndex < options->cardCount; cardIndex++)
+    {
+        bb_card* card = &cards[cardIndex];
+        card->id = cardIndex + 1;
+        card->rect = (oc_rect){
+            (cardIndex % columnCount) * BB_BENCH_CARD_SPACING,
+            (cardIndex / columnCount) * BB_BENCH_CARD_SPACING,
+            BB_BENCH_CARD_SIZE,
+            BB_BENCH_CARD_SIZE,
+        };
+        card->displayRect = card->rect;
+
+        oc_arena_scope scratch = oc_scratch_begin();
+        oc_str8 program = bb_bench_card_program(scratch.arena, options, scenario, cardIndex);
+        card->root = bb_read_program(&arena, program);
+        oc_scratch_end(scratch);
+
+        if(!card->root)
+        {
+            return (false);
+        }
+        oc_list_push_back(&activeList, &card->listElt);
+    }
+
+    f64* durations = oc_arena_push_array(&arena, f64, options->frameCount);
+    f64 firstDuration = 0;
+    f64 totalDuration = 0;
+    u64 totalIterations = 0;
+    u64 maxIterations = 0;
+    u64 totalScanned = 0;
+    u64 totalRetracted = 0;
+    u64 totalEvaluated = 0;
+    u64 totalArenaBytes = 0;
+    u64 maxArenaBytes = 0;
+
+    oc_arena frameArena = { 0 };
+    oc_arena_init(&frameArena);
+
+    for(u32 frameIndex = 0; frameIndex < options->frameCount; frameIndex++)
+    {
+        if(frameIndex)
+        {
+            //NOTE: move the cards in turn, back and forth, so that every frame has a changed input
+            bb_card* card = &cards[frameIndex % options->cardCount];
+            f32 step = ((frameIndex / options->cardCount) & 1) ? -BB_BENCH_MOVE_STEP : BB_BENCH_MOVE_STEP;
+            card->rect.x += step;
+            card->displayRect = card->rect;
+        }
+
+        oc_arena_clear(&frameArena);
+
+        bb_program_stats stats = bb_program_update(&frameArena, factDb, activeList);
+
+        u64 arenaBytes = bb_bench_arena_bytes(&frameArena);
+        for(u32 i = 1; i < factDb->workerCount; i++)
+        {
+            arenaBytes += bb_bench_arena_bytes(factDb->workers[i].arena);
+        }
+
+        if(frameIndex == 0)
+        {
+            firstDuration = stats.duration;
+        }
+        durations[frameIndex] = stats.duration;
+        totalDuration += stats.duration;
+        totalIterations += stats.iterations;
+        maxIterations = oc_max(maxIterations, stats.iterations);
+        totalScanned += stats.factsScanned;
+        totalRetracted += stats.factsRetracted;
+        totalEvaluated += stats.cardsEvaluated;
+        totalArenaBytes += arenaBytes;
+        maxArenaBytes = oc_max(maxArenaBytes, arenaBytes);
+    }
+
+    //NOTE: latency percentiles are computed over the frames following the first one, which builds the db
+    u32 updateCount = options->frameCount ? options->frameCount - 1 : 0;
+    qsort(durations + 1, updateCount, sizeof(f64), bb_bench_compare_f64);
+    u32 frameCount = oc_max(options->frameCount, 1);
+
+    printf("%s  {\n", first ? "" : ",\n");
+    printf("    \"scenario\": \"%s\",\n", BB_BENCH_SCENARIO_NAMES[scenario]);
+    printf("    \"cards\": %u,\n", options->cardCount);
+    printf("    \"claims\": %u,\n", options->claimCount);
+    printf("    \"depth\": %u,\n", options->depth);
+    printf("    \"fanOut\": %u,\n", options->fanOut);
+    printf("    \"whiskerPercent\": %u,\n", options->whiskerPercent);
+    printf("    \"frames\": %u,\n", options->frameCount);
+    printf("    \"workers\": %u,\n", factDb->workerCount);
+    printf("    \"incremental\": %s,\n", options->incremental ? "true" : "false");
+    printf("    \"facts\": %u,\n", factDb->factCount);
+    printf("    \"iterationsMean\": %.2f,\n", (f64)totalIterations / frameCount);
+    printf("    \"iterationsMax\": %" PRIu64 ",\n", maxIterations);
+    printf("    \"factsScannedMean\": %.2f,\n", (f64)totalScanned / frameCount);
+    printf("    \"factsRetractedMean\": %.2f,\n", (f64)totalRetracted / frameCount);
+    printf("    \"cardsEvaluatedMean\": %.2f,\n", (f64)totalEvaluated / frameCount);
+    printf("    \"frameArenaBytesMean\": %.0f,\n", (f64)totalArenaBytes / frameCount);
+    printf("    \"frameArenaBytesMax\": %" PRIu64 ",\n", maxArenaBytes);
+    printf("    \"stringBytes\": %" PRIu64 ",\n", factDb->strings.bytes);
+    printf("    \"firstFrameMs\": %.4f,\n", firstDuration * 1000.);
+    printf("    \"meanMs\": %.4f,\n", totalDuration * 1000. / frameCount);
+    printf("    \"p50Ms\": %.4f,\n", bb_bench_percentile(durations + 1, updateCount, 50) * 1000.);
+    printf("    \"p99Ms\": %.4f\n", bb_bench_percentile(durations + 1, updateCount, 99) * 1000.);
+    printf("  }");
+
+    bb_fact_db_cleanup(factDb);
+    free(factDb);
+
+    oc_arena_cleanup(&frameArena);
+    oc_arena_cleanup(&arena);
+    return (true);
+}
+
+void bb_bench_print_usage(const char* name)
+{
+    printf("usage: %s [options]\n"
+           "  -c cards     number of cards (default 256)\n"
+           "  -m claims    number of attribute claims per card (default 4)\n"
+           "  -d depth     length of the chain of whens deriving the stages of a card (default 4)\n"
+           "  -f fanout    number of cards in each group, which all join with each other (default 4)\n"
+           "  -p percent   percentage of cards with a whisker in the points scenario (default 25)\n"
+           "  -F frames    number of frames to run (default 200)\n"
+           "  -w workers   number of workers evaluating cards, 0 for one per core (default 0)\n"
+           "  -n           rebuild the facts db from scratch each frame instead of updating it incrementally\n"
+           "  -s scenario  labels, highlights, points or all (default all)\n",
+           name);
+}
+
+int main(int argc, char** argv)
+{
+    bb_bench_options options = {
+        .cardCount = 256,
+        .claimCount = 4,
+        .depth = 4,
+        .fanOut = 4,
+        .whiskerPercent = 25,
+        .frameCount = 200,
+        .workerCount = 0,
+        .incremental = true,
+    };
+    u32 scenarioMask = (1 << BB_BENCH_SCENARIO_COUNT) - 1;
+
+    for(int argIndex = 1; argIndex < argc; argIndex++)
+    {
+        const char* arg = argv[argIndex];
+        const char* value = (argIndex + 1 < argc) ? argv[argIndex + 1] : 0;
+        u32* option = 0;
+
+        if(!strcmp(arg, "-c"))
+        {
+            option = &options.cardCount;
+        }
+        else if(!strcmp(arg, "-m"))
+        {
+            option = &options.claimCount;
+        }
+        else if(!strcmp(arg, "-d"))
+        {
+            option = &options.depth;
+        }
+        else if(!strcmp(arg, "-f"))
+        {
+            option = &options.fanOut;
+        }
+        else if(!strcmp(arg, "-p"))
+        {
+            option = &options.whiskerPercent;
+        }
+        else if(!strcmp(arg, "-F"))
+        {
+            option = &options.frameCount;
+        }
+        else if(!strcmp(arg, "-w"))
+        {
+            option = &options.workerCount;
+        }
+        else if(!strcmp(arg, "-n"))
+        {
+            options.incremental = false;
+            continue;
+        }
+        else if(!strcmp(arg, "-s") && value)
+        {
+            scenarioMask = 0;
+            for(u32 i = 0; i < BB_BENCH_SCENARIO_COUNT; i++)
+            {
+                if(!strcmp(value, "all") || !strcmp(value, BB_BENCH_SCENARIO_NAMES[i]))
+                {
+                    scenarioMask |= (1 << i);
+                }
+            }
+            if(!scenarioMask)
+            {
+                bb_bench_print_usage(argv[0]);
+                return (-1);
+            }
+            argIndex++;
+            continue;
+        }
+
+        if(!option || !value)
+        {
+            bb_bench_print_usage(argv[0]);
+            return (-1);
+        }
+        *option = strtoul(value, 0, 10);
+        argIndex++;
+    }
+
+    if(!options.cardCount)
+    {
+        bb_bench_print_usage(argv[0]);
+        return (-1);
+    }
+
+    printf("[\n");
+    bool first = true;
+    for(u32 scenario = 0; scenario < BB_BENCH_SCENARIO_COUNT; scenario++)
+    {
+        if(scenarioMask & (1 << scenario))
+        {
+            if(!bb_bench_run(&options, scenario, first))
+            {
+                return (-1);
+            }
+            first = false;
+        }
+    }
+    printf("\n]\n");
+
+    return (0);
+}
@@ -0,0 +1,4068 @@
+/*************************************************************************
+*
+*  HMNJam24
+*  Copyright 2024 Martin Fouilleul
+*
+**************************************************************************/
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define _USE_MATH_DEFINES //NOTE: necessary for MSVC
+#include <math.h>
+
+#include "engine.h"
+
+//------------------------------------------------------------------------------------------------
+// Atoms
+//------------------------------------------------------------------------------------------------
+
+//NOTE: atoms are acquired by the code compiled from cards, and by the values stored in the facts db. Atoms whose
+//      last reference is released are put on a released list, and freed by bb_atom_collect() once the update
+//      is over, so that ids aren't reused while transient values still hold them. Their ids and entries are then
+//      reused by the next atoms.
+//
+//      The table is a global that isn't synchronized: atoms are only acquired, released and collected from the
+//      thread that calls bb_program_update(), outside of parallel passes. Workers only read atom strings.
+
+typedef struct bb_atom_entry
+{
+    oc_list_elt bucketElt;
+    oc_list_elt releasedElt;
+    u64 hash;
+    oc_str8 string;
+    bb_atom atom;
+    u32 refCount;
+} bb_atom_entry;
+
+typedef struct bb_atom_table
+{
+    oc_arena arena;
+
+    u32 count;
+    u32 liveCount;
+    u32 capacity;
+    bb_atom_entry** entries;
+
+    u32 bucketCount;
+    oc_list* buckets;
+
+    oc_list released;
+    oc_list freeEntries;
+} bb_atom_table;
+
+bb_atom_table bb_global_atoms = { 0 };
+
+void bb_atom_table_init(bb_atom_table* table)
+{
+    oc_arena_init(&table->arena);
+
+    table->capacity = 256;
+    table->entries = oc_arena_push_array(&table->arena, bb_atom_entry*, table->capacity);
+
+    table->bucketCount = 256;
+    table->buckets = oc_arena_push_array(&table->arena, oc_list, table->bucketCount);
+    memset(table->buckets, 0, table->bucketCount * sizeof(oc_list));
+
+    //NOTE: acquire builtin atoms in order, so that their ids match the BB_ATOM_XXX enum. They are never released.
+#define X(name, str)                                  \
+    {                                                 \
+        bb_atom atom = bb_atom_acquire(OC_STR8(str)); \
+        OC_DEBUG_ASSERT(atom == OC_CAT2(BB_ATOM_, name)); \
+    }
+    BB_BUILTIN_ATOMS(X)
+#undef X
+}
+
+bb_atom bb_atom_acquire(oc_str8 string)
+{
+    bb_atom_table* table = &bb_global_atoms;
+    if(!table->buckets)
+    {
+        bb_atom_table_init(table);
+    }
+
+    u64 hash = oc_hash_xx64_string(string);
+
+    oc_list_for(table->buckets[hash & (table->bucketCount - 1)], entry, bb_atom_entry, bucketElt)
+    {
+        if(entry->hash == hash && !oc_str8_cmp(entry->string, string))
+        {
+            bb_atom_retain(entry->atom);
+            return (entry->atom);
+        }
+    }
+
+    bb_atom_entry* entry = oc_list_pop_front_entry(&table->freeEntries, bb_atom_entry, bucketElt);
+    if(!entry)
+    {
+        if(table->count == table->capacity)
+        {
+            u32 capacity = table->capacity * 2;
+            bb_atom_entry** entries = oc_arena_push_array(&table->arena, bb_atom_entry*, capacity);
+            memcpy(entries, table->entries, table->count * sizeof(bb_atom_entry*));
+            table->capacity = capacity;
+            table->entries = entries;
+        }
+
+        if(table->count >= table->bucketCount)
+        {
+            u32 bucketCount = table->bucketCount * 2;
+            oc_list* buckets = oc_arena_push_array(&table->arena, oc_list, bucketCount);
+            memset(buckets, 0, bucketCount * sizeof(oc_list));
+
+            for(u32 i = 0; i < table->count; i++)
+            {
+                bb_atom_entry* other = table->entries[i];
+                if(other->string.ptr)
+                {
+                    oc_list_push_back(&buckets[other->hash & (bucketCount - 1)], &other->bucketElt);
+                }
+            }
+            table->bucketCount = bucketCount;
+            table->buckets = buckets;
+        }
+
+        entry = oc_arena_push_type(&table->arena, bb_atom_entry);
+        memset(entry, 0, sizeof(bb_atom_entry));
+        entry->atom = table->count;
+
+        table->entries[table->count] = entry;
+        table->count++;
+    }
+
+    entry->hash = hash;
+    entry->string.ptr = malloc(string.len + 1);
+    entry->string.len = string.len;
+    memcpy(entry->string.ptr, string.ptr, string.len);
+    entry->string.ptr[string.len] = '\0';
+    entry->refCount = 1;
+    table->liveCount++;
+
+    oc_list_push_back(&table->buckets[hash & (table->bucketCount - 1)], &entry->bucketElt);
+
+    return (entry->atom);
+}
+
+void bb_atom_retain(bb_atom atom)
+{
+    bb_atom_entry* entry = bb_global_atoms.entries[atom];
+    if(!entry->refCount)
+    {
+        oc_list_remove(&bb_global_atoms.released, &entry->releasedElt);
+    }
+    entry->refCount++;
+}
+
+void bb_atom_release(bb_atom atom)
+{
+    bb_atom_entry* entry = bb_global_atoms.entries[atom];
+    OC_DEBUG_ASSERT(entry->refCount);
+
+    entry->refCount--;
+    if(!entry->refCount)
+    {
+        oc_list_push_back(&bb_global_atoms.released, &entry->releasedElt);
+    }
+}
+
+u32 bb_atom_collect(void)
+{
+    bb_atom_table* table = &bb_global_atoms;
+    u32 freeCount = 0;
+
+    oc_list_for_safe(table->released, entry, bb_atom_entry, releasedElt)
+    {
+        oc_list_remove(&table->released, &entry->releasedElt);
+        oc_list_remove(&table->buckets[entry->hash & (table->bucketCount - 1)], &entry->bucketElt);
+
+        free(entry->string.ptr);
+        entry->string = (oc_str8){ 0 };
+
+        oc_list_push_back(&table->freeEntries, &entry->bucketElt);
+        table->liveCount--;
+        freeCount++;
+    }
+    return (freeCount);
+}
+
+oc_str8 bb_atom_string(bb_atom atom)
+{
+    OC_DEBUG_ASSERT(atom < bb_global_atoms.count && bb_global_atoms.entries[atom]->string.ptr);
+    return (bb_global_atoms.entries[atom]->string);
+}
+
+u32 bb_atom_live_count(void)
+{
+    return (bb_global_atoms.liveCount);
+}
+
+//------------------------------------------------------------------------------------------------
+// Cells
+//------------------------------------------------------------------------------------------------
+
+f32 BB_WHISKER_SIZE = 100;
+
+bool bb_cell_has_children(bb_cell* cell)
+{
+    return (cell->kind == BB_CELL_LIST);
+}
+
+bool bb_cell_has_text(bb_cell* cell)
+{
+    return (cell->kind >= BB_CELL_HOLE && cell->kind <= BB_CELL_PLACEHOLDER);
+}
+
+void bb_cell_push(bb_cell* parent, bb_cell* cell)
+{
+    OC_DEBUG_ASSERT(cell != parent);
+    cell->parent = parent;
+    oc_list_push_back(&parent->children, &cell->parentElt);
+    cell->parent->childCount++;
+}
+
+void bb_cell_insert(bb_cell* afterSibling, bb_cell* cell)
+{
+    OC_DEBUG_ASSERT(cell != afterSibling->parent);
+    cell->parent = afterSibling->parent;
+    oc_list_insert(&cell->parent->children, &afterSibling->parentElt, &cell->parentElt);
+    cell->parent->childCount++;
+}
+
+void bb_cell_insert_before(bb_cell* beforeSibling, bb_cell* cell)
+{
+    OC_DEBUG_ASSERT(cell != beforeSibling->parent);
+    cell->parent = beforeSibling->parent;
+    oc_list_insert_before(&cell->parent->children, &beforeSibling->parentElt, &cell->parentElt);
+    cell->parent->childCount++;
+}
+
+oc_str8 bb_cell_to_str8(oc_arena* arena, bb_cell* cell)
+{
+    oc_str8 str = { 0 };
+    switch(cell->kind)
+    {
+        case BB_CELL_LIST:
+        {
+            oc_str8_list list = { 0 };
+
+            oc_str8_list_pushf(arena, &list, "(");
+            oc_list_for(cell->children, child, bb_cell, parentElt)
+            {
+                if(child != bb_cell_first_child(cell))
+                {
+                    oc_str8_list_pushf(arena, &list, " ");
+                }
+                oc_str8_list_push(arena, &list, bb_cell_to_str8(arena, child));
+            }
+            oc_str8_list_pushf(arena, &list, ")");
+            str = oc_str8_list_join(arena, list);
+        }
+        break;
+
+        case BB_CELL_STRING:
+            str = oc_str8_pushf(arena, "\"%.*s\"", oc_str8_ip(cell->text));
+            break;
+
+        case BB_CELL_COMMENT:
+            break;
+
+        default:
+            str = oc_str8_push_copy(arena, cell->text);
+            break;
+    }
+    return (str);
+}
+
+//------------------------------------------------------------------------------------
+// Lexing
+//------------------------------------------------------------------------------------
+
+typedef struct bb_lex_entry
+{
+    bb_token token;
+    oc_str8 string;
+} bb_lex_entry;
+
+const bb_lex_entry BB_LEX_OPERATORS[] = {
+#define X(tok, str) { .token = OC_CAT2(BB_TOKEN_, tok), .string = OC_STR8_LIT(str) },
+    BB_TOKEN_OPERATORS(X)
+#undef X
+};
+const u32 BB_LEX_OPERATOR_COUNT = sizeof(BB_LEX_OPERATORS) / sizeof(bb_lex_entry);
+
+const bb_lex_entry BB_LEX_KEYWORDS[] = {
+#define X(tok, str) { .token = OC_CAT2(BB_TOKEN_, tok), .string = OC_STR8_LIT(str) },
+    BB_TOKEN_KEYWORDS(X)
+#undef X
+};
+const u32 BB_LEX_KEYWORD_COUNT = sizeof(BB_LEX_KEYWORDS) / sizeof(bb_lex_entry);
+
+bb_lex_result bb_lex_operator(oc_str8 string, u64 byteOffset)
+{
+    u64 startOffset = byteOffset;
+    u64 endOffset = byteOffset + 1;
+
+    while(endOffset < string.len)
+    {
+        char c = string.ptr[endOffset];
+        if(c == '+' || c == '-' || c == '*' || c == '/' || c == '%'
+           || c == '!' || c == '=' || c == '<' || c == '>')
+        {
+            endOffset += 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+    bb_lex_result result = { .string = oc_str8_slice(string, startOffset, endOffset),
+                             .kind = BB_CELL_OPERATOR };
+
+    for(int i = 0; i < BB_LEX_OPERATOR_COUNT; i++)
+    {
+        if(!oc_str8_cmp(result.string, BB_LEX_OPERATORS[i].string))
+        {
+            result.valU64 = BB_LEX_OPERATORS[i].token;
+            break;
+        }
+    }
+
+    return (result);
+}
+
+bb_lex_result bb_lex_placeholder(oc_str8 string, u64 byteOffset)
+{
+    u64 startOffset = byteOffset;
+    u64 endOffset = byteOffset + 1;
+
+    while(endOffset < string.len)
+    {
+        char c = string.ptr[endOffset];
+        if((c >= 'a' && c <= 'z')
+           || (c >= 'A' && c <= 'Z')
+           || (c >= '0' && c <= '9')
+           || c == '_')
+        {
+            endOffset += 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+    bb_lex_result result = { .string = oc_str8_slice(string, startOffset, endOffset),
+                             .kind = BB_CELL_PLACEHOLDER };
+    return (result);
+}
+
+bb_lex_result bb_lex_identifier(oc_str8 string, u64 byteOffset)
+{
+    u64 startOffset = byteOffset;
+    u64 endOffset = byteOffset + oc_utf8_size_from_leading_char(string.ptr[startOffset]);
+
+    while(endOffset < string.len)
+    {
+        char c = string.ptr[endOffset];
+        if((c >= 'a' && c <= 'z')
+           || (c >= 'A' && c <= 'Z')
+           || (c >= '0' && c <= '9')
+           || c == '_'
+           || c == ':')
+        {
+            endOffset += 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+    bb_lex_result result = { .string = oc_str8_slice(string, startOffset, endOffset),
+                             .kind = BB_CELL_SYMBOL };
+
+    return (result);
+}
+
+bb_lex_result bb_lex_identifier_or_keyword(oc_str8 string, u64 byteOffset)
+{
+    bb_lex_result result = bb_lex_identifier(string, byteOffset);
+
+    for(int i = 0; i < BB_LEX_KEYWORD_COUNT; i++)
+    {
+        if(!oc_str8_cmp(result.string, BB_LEX_KEYWORDS[i].string))
+        {
+            result.kind = BB_CELL_KEYWORD;
+            result.valU64 = BB_LEX_KEYWORDS[i].token;
+            break;
+        }
+    }
+
+    return (result);
+}
+
+bb_lex_result bb_lex_number(oc_str8 string, u64 byteOffset)
+{
+    u64 startOffset = byteOffset;
+    u64 endOffset = byteOffset;
+
+    u64 numberU64 = 0;
+    while(endOffset < string.len)
+    {
+        char c = string.ptr[endOffset];
+        if(c >= '0' && c <= '9')
+        {
+            numberU64 *= 10;
+            numberU64 += c - '0';
+            endOffset += 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    bb_lex_result result = {};
+
+    if(endOffset < string.len
+       && string.ptr[endOffset] == '.'
+       && (endOffset + 1 >= string.len
+           || string.ptr[endOffset + 1] != '.'))
+    {
+        endOffset += 1;
+
+        u64 decimals = 0;
+        u64 decimalCount = 0;
+
+        while(endOffset < string.len)
+        {
+            char c = string.ptr[endOffset];
+            if(c >= '0' && c <= '9')
+            {
+                decimals *= 10;
+                decimals += c - '0';
+                endOffset += 1;
+                decimalCount += 1;
+            }
+            else
+            {
+                break;
+            }
+        }
+        result.kind = BB_CELL_FLOAT;
+        result.string = oc_str8_slice(string, startOffset, endOffset);
+        result.valF64 = (f64)numberU64 + (f64)decimals / pow(10, decimalCount);
+    }
+    else
+    {
+        result.kind = BB_CELL_INT;
+        result.string = oc_str8_slice(string, startOffset, endOffset);
+        result.valU64 = numberU64;
+    }
+    return (result);
+}
+
+bb_lex_result bb_lex_error(oc_str8 string, u64 byteOffset)
+{
+    bb_lex_result result = { 0 };
+
+    u64 startOffset = byteOffset;
+    u64 endOffset = startOffset;
+
+    while(endOffset < string.len)
+    {
+        oc_utf8_dec decode = oc_utf8_decode_at(string, endOffset);
+        oc_utf32 c = decode.codepoint;
+
+        if((c == '$')
+           || (c >= 'a' && c <= 'z')
+           || (c >= 'A' && c <= 'Z')
+           || (c >= '0' && c <= '9')
+           || (c == '_')
+           || (c == '+' || c == '-' || c == '*' || c == '/' || c == '%'
+               || c == '!' || c == '=' || c == '<' || c == '>'))
+        {
+            goto end;
+        }
+        endOffset += decode.size;
+    }
+end:
+    result = (bb_lex_result){ .string = oc_str8_slice(string, startOffset, endOffset),
+                              .kind = BB_CELL_SYMBOL };
+    return (result);
+}
+
+bb_lex_result bb_lex_next(oc_str8 string, u64 byteOffset, bb_cell_kind srcKind)
+{
+    bb_lex_result result = {};
+
+    if(srcKind == BB_CELL_STRING
+       || srcKind == BB_CELL_COMMENT)
+    {
+        //TODO for quote, set valU64?
+        result.string = oc_str8_slice(string, byteOffset, string.len);
+        result.kind = srcKind;
+    }
+    else if(byteOffset >= string.len)
+    {
+        //WARN: hole
+        result.string = (oc_str8){ 0 };
+        result.kind = BB_CELL_HOLE;
+    }
+    else
+    {
+        oc_utf8_dec decode = oc_utf8_decode_at(string, byteOffset);
+        oc_utf32 c = decode.codepoint;
+
+        if(c == '$')
+        {
+            result = bb_lex_placeholder(string, byteOffset);
+        }
+        else if((c >= 'a' && c <= 'z')
+                || (c >= 'A' && c <= 'Z')
+                || c == '_')
+        {
+            result = bb_lex_identifier_or_keyword(string, byteOffset);
+        }
+        else if(c == '+' || c == '-' || c == '*' || c == '/' || c == '%'
+                || c == '!' || c == '=' || c == '<' || c == '>')
+        {
+            result = bb_lex_operator(string, byteOffset);
+        }
+        else if(c >= '0' && c <= '9')
+        {
+            result = bb_lex_number(string, byteOffset);
+        }
+        else
+        {
+            result = bb_lex_error(string, byteOffset);
+        }
+    }
+    return (result);
+}
+
+//------------------------------------------------------------------------------------
+// Reading
+//------------------------------------------------------------------------------------
+
+//NOTE: reads card programs written as text, so that they can be run without the editor. Lists are delimited by
+//      parentheses, strings by double quotes, and other words are split into cells the same way the editor does.
+
+typedef struct bb_reader
+{
+    oc_arena* arena;
+    u64 nextCellId;
+    oc_str8 text;
+    u64 offset;
+} bb_reader;
+
+bb_cell* bb_reader_cell_alloc(bb_reader* reader, bb_cell_kind kind)
+{
+    bb_cell* cell = oc_arena_push_type(reader->arena, bb_cell);
+    memset(cell, 0, sizeof(bb_cell));
+    cell->id = reader->nextCellId++;
+    cell->kind = kind;
+    return (cell);
+}
+
+void bb_reader_push_word(bb_reader* reader, bb_cell* parent, oc_str8 string, bb_cell_kind srcKind)
+{
+    //NOTE: a word can hold several tokens, eg. 'n+1'
+    u64 byteOffset = 0;
+    do
+    {
+        bb_lex_result lex = bb_lex_next(string, byteOffset, srcKind);
+        byteOffset += lex.string.len;
+
+        bb_cell* cell = bb_reader_cell_alloc(reader, lex.kind);
+        cell->text = lex.string;
+        cell->valU64 = lex.valU64;
+        cell->valF64 = lex.valF64;
+
+        bb_cell_push(parent, cell);
+    }
+    while(byteOffset < string.len);
+}
+
+bool bb_reader_is_space(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+bool bb_reader_read_list(bb_reader* reader, bb_cell* list)
+{
+    oc_str8 text = reader->text;
+
+    while(reader->offset < text.len)
+    {
+        char c = text.ptr[reader->offset];
+
+        if(bb_reader_is_space(c))
+        {
+            reader->offset++;
+        }
+        else if(c == '(')
+        {
+            reader->offset++;
+            bb_cell* child = bb_reader_cell_alloc(reader, BB_CELL_LIST);
+            bb_cell_push(list, child);
+
+            if(!bb_reader_read_list(reader, child))
+            {
+                return (false);
+            }
+        }
+        else if(c == ')')
+        {
+            if(!list->parent)
+            {
+                oc_log_error("unexpected ')' at offset %" PRIu64 "\n", reader->offset);
+                return (false);
+            }
+            reader->offset++;
+            return (true);
+        }
+        else if(c == '"')
+        {
+            reader->offset++;
+            u64 start = reader->offset;
+            while(reader->offset < text.len && text.ptr[reader->offset] != '"')
+            {
+                reader->offset++;
+            }
+            if(reader->offset >= text.len)
+            {
+                oc_log_error("unterminated string at offset %" PRIu64 "\n", start - 1);
+                return (false);
+            }
+            bb_reader_push_word(reader, list, oc_str8_slice(text, start, reader->offset), BB_CELL_STRING);
+            reader->offset++;
+        }
+        else
+        {
+            u64 start = reader->offset;
+            while(reader->offset < text.len)
+            {
+                c = text.ptr[reader->offset];
+                if(bb_reader_is_space(c) || c == '(' || c == ')' || c == '"')
+                {
+                    break;
+                }
+                reader->offset++;
+            }
+            bb_reader_push_word(reader, list, oc_str8_slice(text, start, reader->offset), BB_CELL_SYMBOL);
+        }
+    }
+
+    if(list->parent)
+    {
+        oc_log_error("missing ')' at end of text\n");
+        return (false);
+    }
+    return (true);
+}
+
+bb_cell* bb_read_program(oc_arena* arena, oc_str8 text)
+{
+    bb_reader reader = {
+        .arena = arena,
+        .nextCellId = 1,
+        .text = oc_str8_push_copy(arena, text),
+    };
+
+    bb_cell* root = bb_reader_cell_alloc(&reader, BB_CELL_LIST);
+    if(!bb_reader_read_list(&reader, root))
+    {
+        return (0);
+    }
+    return (root);
+}
+
+//------------------------------------------------------------------------------------------------
+// Rule system
+//------------------------------------------------------------------------------------------------
+
+enum
+{
+    BB_FACT_DB_MIN_BUCKET_COUNT = 1024,
+};
+
+u64 bb_value_hash(bb_value* value, u64 seed)
+{
+    u64 hash = oc_hash_xx64_string_seed(oc_str8_from_buffer(sizeof(bb_value_kind), (char*)&value->kind), seed);
+
+    switch(value->kind)
+    {
+        case BB_VALUE_SYMBOL:
+        case BB_VALUE_STRING:
+        case BB_VALUE_PLACEHOLDER:
+            hash = oc_hash_xx64_string_seed(oc_str8_from_buffer(sizeof(bb_atom), (char*)&value->atom), hash);
+            break;
+
+        case BB_VALUE_U64:
+        case BB_VALUE_CARD_ID:
+            hash = oc_hash_xx64_string_seed(oc_str8_from_buffer(sizeof(u64), (char*)&value->valU64), hash);
+            break;
+
+        case BB_VALUE_F64:
+        {
+            //NOTE: 0. and -0. compare equal, so they must hash the same
+            f64 f = (value->valF64 == 0) ? 0 : value->valF64;
+            hash = oc_hash_xx64_string_seed(oc_str8_from_buffer(sizeof(f64), (char*)&f), hash);
+        }
+        break;
+
+        case BB_VALUE_LIST:
+        {
+            bb_value_for(value, child)
+            {
+                hash = bb_value_hash(child, hash);
+            }
+        }
+        break;
+    }
+    return (hash);
+}
+
+bool bb_value_equal(bb_value* a, bb_value* b)
+{
+    bool equal = (a->kind == b->kind);
+    if(equal)
+    {
+        switch(a->kind)
+        {
+            case BB_VALUE_SYMBOL:
+            case BB_VALUE_STRING:
+            case BB_VALUE_PLACEHOLDER:
+                equal = (a->atom == b->atom);
+                break;
+
+            case BB_VALUE_U64:
+            case BB_VALUE_CARD_ID:
+                equal = (a->valU64 == b->valU64);
+                break;
+
+            case BB_VALUE_F64:
+                equal = (a->valF64 == b->valF64);
+                break;
+
+            case BB_VALUE_LIST:
+            {
+                equal = (a->size == b->size && a->count == b->count);
+                for(u32 i = 1; i < a->size && equal; i += a[i].size)
+                {
+                    equal = bb_value_equal(&a[i], &b[i]);
+                }
+            }
+            break;
+        }
+    }
+    return (equal);
+}
+
+u32 bb_tuple_size_class(u32 size)
+{
+    u32 sizeClass = 0;
+    while(sizeClass < BB_TUPLE_CLASS_COUNT && (BB_TUPLE_MIN_SIZE << sizeClass) < size)
+    {
+        sizeClass++;
+    }
+    return (sizeClass);
+}
+
+bool bb_value_has_atom(bb_value* value)
+{
+    return (value->kind == BB_VALUE_SYMBOL || value->kind == BB_VALUE_STRING || value->kind == BB_VALUE_PLACEHOLDER);
+}
+
+bb_value* bb_fact_db_copy_value(bb_facts_db* factDb, bb_value* value)
+{
+    //NOTE: tuples are allocated from size-classed pools. Tuples that are too large for the biggest class
+    //      are allocated on the heap.
+    bb_value* copy = 0;
+    u32 sizeClass = bb_tuple_size_class(value->size);
+    if(sizeClass < BB_TUPLE_CLASS_COUNT)
+    {
+        copy = oc_pool_alloc(&factDb->tuplePools[sizeClass]);
+    }
+    else
+    {
+        copy = malloc(value->size * sizeof(bb_value));
+    }
+    memcpy(copy, value, value->size * sizeof(bb_value));
+
+    //NOTE: values stored in the db hold a reference to their atoms
+    for(u32 i = 0; i < value->size; i++)
+    {
+        if(bb_value_has_atom(&value[i]))
+        {
+            bb_atom_retain(value[i].atom);
+        }
+    }
+    return (copy);
+}
+
+void bb_fact_db_recycle_value(bb_facts_db* factDb, bb_value* value)
+{
+    for(u32 i = 0; i < value->size; i++)
+    {
+        if(bb_value_has_atom(&value[i]))
+        {
+            bb_atom_release(value[i].atom);
+        }
+    }
+
+    u32 sizeClass = bb_tuple_size_class(value->size);
+    if(sizeClass < BB_TUPLE_CLASS_COUNT)
+    {
+        oc_pool_recycle(&factDb->tuplePools[sizeClass], value);
+    }
+    else
+    {
+        free(value);
+    }
+}
+
+//------------------------------------------------------------------------------------------
+// String store
+//------------------------------------------------------------------------------------------
+
+u32 bb_string_size_class(u64 size)
+{
+    u32 sizeClass = 0;
+    while(sizeClass < BB_STRING_CLASS_COUNT && (BB_STRING_MIN_SIZE << sizeClass) < size)
+    {
+        sizeClass++;
+    }
+    return (sizeClass);
+}
+
+bb_string* bb_string_acquire(bb_string_store* store, oc_str8 string)
+{
+    u64 hash = oc_hash_xx64_string(string);
+    oc_list* bucket = &store->buckets[hash % BB_STRING_BUCKET_COUNT];
+
+    oc_list_for(*bucket, entry, bb_string, bucketElt)
+    {
+        if(entry->hash == hash && !oc_str8_cmp(entry->string, string))
+        {
+            entry->refCount++;
+            return (entry);
+        }
+    }
+
+    //NOTE: the characters are stored right after the header. Strings that are too large for the biggest
+    //      class are allocated on the heap.
+    u64 size = sizeof(bb_string) + string.len;
+    u32 sizeClass = bb_string_size_class(size);
+
+    bb_string* entry = 0;
+    if(sizeClass < BB_STRING_CLASS_COUNT)
+    {
+        entry = oc_pool_alloc(&store->pools[sizeClass]);
+    }
+    else
+    {
+        entry = malloc(size);
+    }
+    memset(entry, 0, sizeof(bb_string));
+    entry->hash = hash;
+    entry->refCount = 1;
+    entry->string = oc_str8_from_buffer(string.len, (char*)(entry + 1));
+    memcpy(entry->string.ptr, string.ptr, string.len);
+
+    oc_list_push_back(bucket, &entry->bucketElt);
+    store->count++;
+    store->bytes += size;
+
+    return (entry);
+}
+
+void bb_string_release(bb_string_store* store, bb_string* entry)
+{
+    OC_DEBUG_ASSERT(entry->refCount);
+    entry->refCount--;
+    if(!entry->refCount)
+    {
+        oc_list_remove(&store->buckets[entry->hash % BB_STRING_BUCKET_COUNT], &entry->bucketElt);
+
+        u64 size = sizeof(bb_string) + entry->string.len;
+        u32 sizeClass = bb_string_size_class(size);
+        if(sizeClass < BB_STRING_CLASS_COUNT)
+        {
+            oc_pool_recycle(&store->pools[sizeClass], entry);
+        }
+        else
+        {
+            free(entry);
+        }
+        store->count--;
+        store->bytes -= size;
+    }
+}
+
+//NOTE: alpha network. Each distinct when or listener pattern has an alpha memory, which holds the facts that
+//      match the constant parts of the pattern, in insertion order. Memories are shared by patterns with the
+//      same shape, and indexed by their first constant top-level element, so that a new fact is only tested
+//      against the memories it can match. Joins between nested whens are recomputed from the memories.
+
+enum
+{
+    BB_ALPHA_BUCKET_COUNT = 1024,
+    BB_ALPHA_ANY_POSITION = ~0U,
+};
+
+bool bb_value_match(bb_value* value, bb_value* pattern)
+{
+    //NOTE: structural match where placeholders match anything, without binding them
+    bool match = false;
+    if(pattern->kind == BB_VALUE_PLACEHOLDER)
+    {
+        match = true;
+    }
+    else if(pattern->kind == BB_VALUE_LIST && value->kind == BB_VALUE_LIST)
+    {
+        match = (value->count == pattern->count);
+
+        bb_value* child = value + 1;
+        bb_value_for(pattern, childPattern)
+        {
+            if(!match)
+            {
+                break;
+            }
+            match = bb_value_match(child, childPattern);
+            child += child->size;
+        }
+    }
+    else
+    {
+        match = bb_value_equal(value, pattern);
+    }
+    return (match);
+}
+
+u64 bb_alpha_key(u32 arity, u32 position, u64 valueHash)
+{
+    u32 data[2] = { arity, position };
+    return (oc_hash_xx64_string_seed(oc_str8_from_buffer(sizeof(data), (char*)data), valueHash));
+}
+
+u64 bb_alpha_pattern_key(bb_value* pattern)
+{
+    //NOTE: patterns are keyed by their arity and their first constant top-level element. Patterns that aren't
+    //      lists, or that don't have constant elements, are keyed by their arity only.
+    u32 arity = BB_ALPHA_ANY_POSITION;
+    u32 position = BB_ALPHA_ANY_POSITION;
+    u64 valueHash = 0;
+
+    if(pattern->kind == BB_VALUE_LIST)
+    {
+        arity = 0;
+        bb_value_for(pattern, child)
+        {
+            if(position == BB_ALPHA_ANY_POSITION
+               && child->kind != BB_VALUE_PLACEHOLDER
+               && child->kind != BB_VALUE_LIST)
+            {
+                position = arity;
+                valueHash = bb_value_hash(child, 0);
+            }
+            arity++;
+        }
+    }
+    return (bb_alpha_key(arity, position, valueHash));
+}
+
+bb_value* bb_alpha_pattern_from_value(oc_arena* arena, bb_value* value)
+{
+    //NOTE: build a copy of a pattern where all placeholders are anonymous, so that patterns with the
+    //      same shape share the same memory
+    bb_value* result = oc_arena_push_array(arena, bb_value, value->size);
+    memcpy(result, value, value->size * sizeof(bb_value));
+
+    for(u32 i = 0; i < result->size; i++)
+    {
+        if(result[i].kind == BB_VALUE_PLACEHOLDER)
+        {
+            result[i] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1 };
+        }
+    }
+    return (result);
+}
+
+void bb_fact_list_push(bb_facts_db* factDb, bb_fact_list* list, oc_list* factEntries, bb_fact* fact)
+{
+    bb_fact_entry* entry = oc_pool_alloc_type(&factDb->factEntryPool, bb_fact_entry);
+    memset(entry, 0, sizeof(bb_fact_entry));
+    entry->fact = fact;
+    entry->list = list;
+    oc_list_push_back(&list->entries, &entry->listElt);
+    oc_list_push_back(factEntries, &entry->factElt);
+    list->count++;
+}
+
+void bb_fact_list_remove(bb_facts_db* factDb, bb_fact_entry* entry, oc_list* factEntries)
+{
+    oc_list_remove(&entry->list->entries, &entry->listElt);
+    oc_list_remove(factEntries, &entry->factElt);
+    entry->list->count--;
+    oc_pool_recycle(&factDb->factEntryPool, entry);
+}
+
+bb_fact_entry* bb_fact_list_first_since(bb_worker* worker, bb_fact_list* list, u64 minIteration)
+{
+    //NOTE: facts produced at or after minIteration form a suffix of the list, so we walk back from the
+    //      end to find the first one. Callers then scan forward to preserve insertion order.
+    bb_fact_entry* first = 0;
+    u64 scanCount = 0;
+    for(bb_fact_entry* entry = oc_list_last_entry(list->entries, bb_fact_entry, listElt);
+        entry != 0 && entry->fact->iteration >= minIteration;
+        entry = oc_list_prev_entry(entry, bb_fact_entry, listElt))
+    {
+        first = entry;
+        scanCount++;
+    }
+    worker->factsScanned += scanCount;
+    worker->factsSkipped += worker->factDb->factCount - scanCount;
+
+    return (first);
+}
+
+bool bb_value_is_indexed(bb_value* value)
+{
+    return (value->kind != BB_VALUE_PLACEHOLDER && value->kind != BB_VALUE_LIST);
+}
+
+bb_arg_index* bb_arg_index_find(bb_facts_db* factDb, u64 key)
+{
+    bb_arg_index* result = 0;
+    oc_list_for(factDb->argBuckets[key & (factDb->argBucketCount - 1)], index, bb_arg_index, bucketElt)
+    {
+        if(index->key == key)
+        {
+            result = index;
+            break;
+        }
+    }
+    return (result);
+}
+
+void bb_arg_index_grow_buckets(bb_facts_db* factDb)
+{
+    //NOTE: same growth policy as the facts hash set
+    u32 bucketCount = factDb->argBucketCount * 2;
+    oc_list* buckets = oc_arena_push_array(&factDb->persistentArena, oc_list, bucketCount);
+    memset(buckets, 0, bucketCount * sizeof(oc_list));
+
+    for(u32 i = 0; i < factDb->argBucketCount; i++)
+    {
+        oc_list_for_safe(factDb->argBuckets[i], index, bb_arg_index, bucketElt)
+        {
+            oc_list_push_back(&buckets[index->key & (bucketCount - 1)], &index->bucketElt);
+        }
+    }
+    factDb->argBucketCount = bucketCount;
+    factDb->argBuckets = buckets;
+}
+
+void bb_arg_index_push(bb_facts_db* factDb, bb_fact* fact, u64 key)
+{
+    bb_arg_index* index = bb_arg_index_find(factDb, key);
+    if(!index)
+    {
+        if(factDb->argIndexCount >= factDb->argBucketCount)
+        {
+            bb_arg_index_grow_buckets(factDb);
+        }
+        index = oc_pool_alloc_type(&factDb->argIndexPool, bb_arg_index);
+        memset(index, 0, sizeof(bb_arg_index));
+        index->key = key;
+        oc_list_push_back(&factDb->argBuckets[key & (factDb->argBucketCount - 1)], &index->bucketElt);
+        factDb->argIndexCount++;
+    }
+    bb_fact_list_push(factDb, &index->facts, &fact->argEntries, fact);
+}
+
+void bb_fact_db_unlink_fact(bb_facts_db* factDb, bb_fact* fact)
+{
+    //NOTE: remove a fact from its alpha memories, argument indexes and the cards supporting it, and recycle
+    //      emptied indexes
+    oc_list_for_safe(fact->supports, support, bb_support, factElt)
+    {
+        oc_list_remove(&support->card->supports, &support->cardElt);
+        oc_pool_recycle(&factDb->supportPool, support);
+    }
+    fact->supports = (oc_list){ 0 };
+    fact->supportCount = 0;
+
+    oc_list_for_safe(fact->alphaEntries, entry, bb_fact_entry, factElt)
+    {
+        bb_alpha_memory* memory = oc_container_of(entry->list, bb_alpha_memory, facts);
+        memory->removeCount++;
+        bb_fact_list_remove(factDb, entry, &fact->alphaEntries);
+    }
+    oc_list_for_safe(fact->argEntries, entry, bb_fact_entry, factElt)
+    {
+        bb_arg_index* index = oc_container_of(entry->list, bb_arg_index, facts);
+        bb_fact_list_remove(factDb, entry, &fact->argEntries);
+
+        if(!index->facts.count)
+        {
+            oc_list_remove(&factDb->argBuckets[index->key & (factDb->argBucketCount - 1)], &index->bucketElt);
+            oc_pool_recycle(&factDb->argIndexPool, index);
+            factDb->argIndexCount--;
+        }
+    }
+}
+
+bb_alpha_memory* bb_alpha_memory_acquire(bb_facts_db* factDb, bb_value* pattern)
+{
+    //NOTE: pattern must be anonymized with bb_alpha_pattern_from_value()
+    u64 key = bb_alpha_pattern_key(pattern);
+    oc_list* bucket = &factDb->alphaBuckets[key & (BB_ALPHA_BUCKET_COUNT - 1)];
+
+    bb_alpha_memory* memory = 0;
+    oc_list_for(*bucket, candidate, bb_alpha_memory, bucketElt)
+    {
+        if(candidate->key == key && bb_value_equal(candidate->pattern, pattern))
+        {
+            memory = candidate;
+            break;
+        }
+    }
+
+    if(!memory)
+    {
+        memory = oc_pool_alloc_type(&factDb->alphaMemoryPool, bb_alpha_memory);
+        memset(memory, 0, sizeof(bb_alpha_memory));
+        memory->key = key;
+        memory->pattern = bb_fact_db_copy_value(factDb, pattern);
+        oc_list_push_back(bucket, &memory->bucketElt);
+
+        //NOTE: populate the memory with the facts already in the db
+        oc_list_for(factDb->facts, fact, bb_fact, listElt)
+        {
+            if(bb_value_match(fact->root, memory->pattern))
+            {
+                bb_fact_list_push(factDb, &memory->facts, &fact->alphaEntries, fact);
+            }
+        }
+    }
+    memory->refCount++;
+    return (memory);
+}
+
+void bb_alpha_memory_release(bb_facts_db* factDb, bb_alpha_memory* memory)
+{
+    memory->refCount--;
+    if(!memory->refCount)
+    {
+        oc_list_for_safe(memory->facts.entries, entry, bb_fact_entry, listElt)
+        {
+            bb_fact_list_remove(factDb, entry, &entry->fact->alphaEntries);
+        }
+        oc_list_remove(&factDb->alphaBuckets[memory->key & (BB_ALPHA_BUCKET_COUNT - 1)], &memory->bucketElt);
+        bb_fact_db_recycle_value(factDb, memory->pattern);
+        oc_pool_recycle(&factDb->alphaMemoryPool, memory);
+    }
+}
+
+void bb_alpha_route_probe(bb_facts_db* factDb, bb_fact* fact, u64 key)
+{
+    oc_list_for(factDb->alphaBuckets[key & (BB_ALPHA_BUCKET_COUNT - 1)], memory, bb_alpha_memory, bucketElt)
+    {
+        bb_fact_entry* last = oc_list_last_entry(memory->facts.entries, bb_fact_entry, listElt);
+        if(memory->key == key
+           && !(last && last->fact == fact)
+           && bb_value_match(fact->root, memory->pattern))
+        {
+            bb_fact_list_push(factDb, &memory->facts, &fact->alphaEntries, fact);
+        }
+    }
+}
+
+void bb_fact_db_index_fact(bb_facts_db* factDb, bb_fact* fact)
+{
+    //NOTE: add the fact to the argument indexes of its elements, and probe the memories keyed by each
+    //      constant element of the fact and the memories keyed by arity only
+    u32 arity = fact->root->count;
+    u32 position = 0;
+    bb_value_for(fact->root, child)
+    {
+        if(bb_value_is_indexed(child))
+        {
+            u64 key = bb_alpha_key(arity, position, bb_value_hash(child, 0));
+            bb_arg_index_push(factDb, fact, key);
+            bb_alpha_route_probe(factDb, fact, key);
+        }
+        position++;
+    }
+    bb_alpha_route_probe(factDb, fact, bb_alpha_key(arity, BB_ALPHA_ANY_POSITION, 0));
+    bb_alpha_route_probe(factDb, fact, bb_alpha_key(BB_ALPHA_ANY_POSITION, BB_ALPHA_ANY_POSITION, 0));
+}
+
+void bb_fact_db_remove(bb_facts_db* factDb, bb_fact* fact)
+{
+    oc_list_remove(&factDb->facts, &fact->listElt);
+    oc_list_remove(&factDb->buckets[fact->hash & (factDb->bucketCount - 1)], &fact->bucketElt);
+    factDb->factCount--;
+
+    bb_fact_db_unlink_fact(factDb, fact);
+    bb_fact_db_recycle_value(factDb, fact->root);
+    oc_pool_recycle(&factDb->factPool, fact);
+}
+
+void bb_fact_db_clear(bb_facts_db* factDb)
+{
+    if(!factDb->buckets)
+    {
+        oc_pool_init(&factDb->factPool, sizeof(bb_fact));
+        for(u32 i = 0; i < BB_TUPLE_CLASS_COUNT; i++)
+        {
+            oc_pool_init(&factDb->tuplePools[i], (BB_TUPLE_MIN_SIZE << i) * sizeof(bb_value));
+        }
+        oc_pool_init(&factDb->alphaMemoryPool, sizeof(bb_alpha_memory));
+        oc_pool_init(&factDb->argIndexPool, sizeof(bb_arg_index));
+        oc_pool_init(&factDb->factEntryPool, sizeof(bb_fact_entry));
+        oc_pool_init(&factDb->supportPool, sizeof(bb_support));
+        for(u32 i = 0; i < BB_STRING_CLASS_COUNT; i++)
+        {
+            oc_pool_init(&factDb->strings.pools[i], BB_STRING_MIN_SIZE << i);
+        }
+
+        factDb->bucketCount = BB_FACT_DB_MIN_BUCKET_COUNT;
+        factDb->buckets = oc_arena_push_array(&factDb->persistentArena, oc_list, factDb->bucketCount);
+
+        factDb->alphaBuckets = oc_arena_push_array(&factDb->persistentArena, oc_list, BB_ALPHA_BUCKET_COUNT);
+        memset(factDb->alphaBuckets, 0, BB_ALPHA_BUCKET_COUNT * sizeof(oc_list));
+
+        factDb->argBucketCount = BB_FACT_DB_MIN_BUCKET_COUNT;
+        factDb->argBuckets = oc_arena_push_array(&factDb->persistentArena, oc_list, factDb->argBucketCount);
+        memset(factDb->argBuckets, 0, factDb->argBucketCount * sizeof(oc_list));
+    }
+    else
+    {
+        oc_list_for_safe(factDb->facts, fact, bb_fact, listElt)
+        {
+            bb_fact_db_unlink_fact(factDb, fact);
+            bb_fact_db_recycle_value(factDb, fact->root);
+            oc_pool_recycle(&factDb->factPool, fact);
+        }
+    }
+    factDb->facts = (oc_list){ 0 };
+    factDb->factCount = 0;
+    memset(factDb->buckets, 0, factDb->bucketCount * sizeof(oc_list));
+}
+
+void bb_fact_db_grow_buckets(bb_facts_db* factDb)
+{
+    //NOTE: double the bucket count and rehash. Old bucket arrays stay in the persistent arena, but since
+    //      the table only ever doubles, this is bounded by the size of the largest table.
+    u32 bucketCount = factDb->bucketCount * 2;
+    oc_list* buckets = oc_arena_push_array(&factDb->persistentArena, oc_list, bucketCount);
+    memset(buckets, 0, bucketCount * sizeof(oc_list));
+
+    oc_list_for(factDb->facts, fact, bb_fact, listElt)
+    {
+        oc_list_push_back(&buckets[fact->hash & (bucketCount - 1)], &fact->bucketElt);
+    }
+    factDb->bucketCount = bucketCount;
+    factDb->buckets = buckets;
+}
+
+bb_fact* bb_fact_db_find(bb_facts_db* factDb, bb_value* root, u64 hash)
+{
+    bb_fact* result = 0;
+    if(factDb->buckets)
+    {
+        oc_list_for(factDb->buckets[hash & (factDb->bucketCount - 1)], fact, bb_fact, bucketElt)
+        {
+            if(fact->hash == hash && bb_value_equal(fact->root, root))
+            {
+                result = fact;
+                break;
+            }
+        }
+    }
+    return (result);
+}
+
+void bb_fact_add_support(bb_facts_db* factDb, bb_fact* fact, bb_card* card, u32 inputs, bool claimer)
+{
+    bb_support* support = 0;
+    oc_list_for(fact->supports, candidate, bb_support, factElt)
+    {
+        if(candidate->card == card)
+        {
+            support = candidate;
+            break;
+        }
+    }
+    if(!support)
+    {
+        support = oc_pool_alloc_type(&factDb->supportPool, bb_support);
+        memset(support, 0, sizeof(bb_support));
+        support->fact = fact;
+        support->card = card;
+        oc_list_push_back(&fact->supports, &support->factElt);
+        oc_list_push_back(&card->supports, &support->cardElt);
+        fact->supportCount++;
+    }
+    support->inputs |= inputs;
+    support->claimer |= claimer;
+}
+
+void bb_fact_db_push(bb_facts_db* factDb, bb_value* root, bb_card* claimer, bb_provenance provenance)
+{
+    //NOTE: check if fact is already in db
+    u64 hash = bb_value_hash(root, 0);
+
+    bb_fact* fact = bb_fact_db_find(factDb, root, hash);
+    if(!fact)
+    {
+        if(!factDb->buckets)
+        {
+            bb_fact_db_clear(factDb);
+        }
+        else if(factDb->factCount >= factDb->bucketCount)
+        {
+            bb_fact_db_grow_buckets(factDb);
+        }
+
+        fact = oc_pool_alloc_type(&factDb->factPool, bb_fact);
+        memset(fact, 0, sizeof(bb_fact));
+
+        fact->iteration = factDb->iteration;
+        fact->hash = hash;
+        fact->root = bb_fact_db_copy_value(factDb, root);
+
+        oc_list_push_back(&factDb->facts, &fact->listElt);
+        oc_list_push_back(&factDb->buckets[hash & (factDb->bucketCount - 1)], &fact->bucketElt);
+        factDb->factCount++;
+
+        bb_fact_db_index_fact(factDb, fact);
+    }
+
+    //NOTE: if the fact already existed, it can now be derived in another way. Its supports accumulate the
+    //      provenance of all its derivations, so that it gets retracted (and possibly re-derived) if any of
+    //      them is invalidated.
+    for(u32 i = 0; i < provenance.count; i++)
+    {
+        bb_fact_add_support(factDb, fact, provenance.deps[i].card, provenance.deps[i].inputs, false);
+    }
+    if(claimer)
+    {
+        bb_fact_add_support(factDb, fact, claimer, 0, true);
+    }
+}
+
+void bb_fact_db_retract(bb_facts_db* factDb, bb_fact* fact)
+{
+    //NOTE: cards that claimed the fact are re-evaluated, to re-derive it if it still holds
+    oc_list_for(fact->supports, support, bb_support, factElt)
+    {
+        if(support->claimer)
+        {
+            support->card->rerun = true;
+        }
+    }
+    bb_fact_db_remove(factDb, fact);
+    factDb->factsRetracted++;
+}
+
+//NOTE: provenances are small, so dependencies are merged by linear search. The result has room for
+//      extraCount more dependencies.
+bb_provenance bb_provenance_copy(oc_arena* arena, bb_provenance provenance, u32 extraCount)
+{
+    bb_provenance result = {
+        .count = provenance.count,
+        .deps = oc_arena_push_array(arena, bb_dependency, provenance.count + extraCount),
+    };
+    memcpy(result.deps, provenance.deps, provenance.count * sizeof(bb_dependency));
+    return (result);
+}
+
+void bb_provenance_add(bb_provenance* provenance, bb_card* card, u32 inputs)
+{
+    bb_dependency* dep = 0;
+    for(u32 i = 0; i < provenance->count; i++)
+    {
+        if(provenance->deps[i].card == card)
+        {
+            dep = &provenance->deps[i];
+            break;
+        }
+    }
+    if(!dep)
+    {
+        dep = &provenance->deps[provenance->count];
+        *dep = (bb_dependency){ .card = card };
+        provenance->count++;
+    }
+    dep->inputs |= inputs;
+}
+
+typedef struct bb_claim
+{
+    oc_list_elt listElt;
+    bb_value* root;
+    bb_card* claimer;
+    bb_provenance provenance;
+} bb_claim;
+
+typedef struct bb_memo_effect
+{
+    oc_list_elt listElt;
+    u32* frame;
+} bb_memo_effect;
+
+typedef struct bb_memo_entry
+{
+    oc_list_elt bucketElt;
+    u64 hash;
+    bb_value* query;
+    oc_list claims;
+    oc_list effects;
+} bb_memo_entry;
+
+void bb_worker_claim(bb_worker* worker, bb_value* root, bb_card* claimer, bb_provenance provenance)
+{
+    if(worker->memoEntry)
+    {
+        oc_arena* memoArena = &worker->memoResponder->memoArena;
+        bb_claim* claim = oc_arena_push_type(memoArena, bb_claim);
+        claim->root = oc_arena_push_array(memoArena, bb_value, root->size);
+        memcpy(claim->root, root, root->size * sizeof(bb_value));
+        claim->claimer = claimer;
+        claim->provenance = bb_provenance_copy(memoArena, provenance, 0);
+        oc_list_push_back(&worker->memoEntry->claims, &claim->listElt);
+    }
+
+    if(worker->deferred)
+    {
+        //NOTE: the db can't be modified while other workers read it, so the claim is copied and pushed when
+        //      the pass ends. Duplicates are merged by bb_fact_db_push() at that point.
+        bb_claim* claim = oc_arena_push_type(worker->arena, bb_claim);
+        claim->root = oc_arena_push_array(worker->arena, bb_value, root->size);
+        memcpy(claim->root, root, root->size * sizeof(bb_value));
+        claim->claimer = claimer;
+        claim->provenance = bb_provenance_copy(worker->arena, provenance, 0);
+        oc_list_push_back(worker->claims, &claim->listElt);
+    }
+    else
+    {
+        bb_fact_db_push(worker->factDb, root, claimer, provenance);
+    }
+}
+
+void bb_worker_set_frame(bb_worker* worker, u32* frame)
+{
+    //NOTE: marks some display state of a card as current, eg. a whisker being drawn
+    *frame = worker->factDb->frame;
+
+    if(worker->memoEntry)
+    {
+        bb_memo_effect* effect = oc_arena_push_type(&worker->memoResponder->memoArena, bb_memo_effect);
+        effect->frame = frame;
+        oc_list_push_back(&worker->memoEntry->effects, &effect->listElt);
+    }
+}
+
+void bb_debug_print_value(bb_value* value)
+{
+    switch(value->kind)
+    {
+        case BB_VALUE_SYMBOL:
+        case BB_VALUE_PLACEHOLDER:
+            printf("%.*s", oc_str8_ip(bb_atom_string(value->atom)));
+            break;
+
+        case BB_VALUE_STRING:
+            printf("\"%.*s\"", oc_str8_ip(bb_atom_string(value->atom)));
+            break;
+
+        case BB_VALUE_U64:
+            printf("%" PRIu64, value->valU64);
+            break;
+
+        case BB_VALUE_F64:
+            printf("%f", value->valF64);
+            break;
+
+        case BB_VALUE_CARD_ID:
+            printf("card-%" PRIu64, value->valU64);
+            break;
+
+        case BB_VALUE_LIST:
+        {
+            printf("(");
+            bb_value_for(value, child)
+            {
+                if(child != value + 1)
+                {
+                    printf(" ");
+                }
+                bb_debug_print_value(child);
+            }
+            printf(")");
+        }
+        break;
+    }
+}
+
+oc_str8 bb_debug_value_to_str8(oc_arena* arena, bb_value* value)
+{
+    oc_str8 str = { 0 };
+    switch(value->kind)
+    {
+        case BB_VALUE_SYMBOL:
+        case BB_VALUE_PLACEHOLDER:
+            str = oc_str8_pushf(arena, "%.*s", oc_str8_ip(bb_atom_string(value->atom)));
+            break;
+
+        case BB_VALUE_STRING:
+            str = oc_str8_pushf(arena, "\"%.*s\"", oc_str8_ip(bb_atom_string(value->atom)));
+            break;
+
+        case BB_VALUE_U64:
+            str = oc_str8_pushf(arena, "%" PRIu64, value->valU64);
+            break;
+
+        case BB_VALUE_F64:
+            str = oc_str8_pushf(arena, "%f", value->valF64);
+            break;
+
+        case BB_VALUE_CARD_ID:
+            str = oc_str8_pushf(arena, "card-%" PRIu64, value->valU64);
+            break;
+
+        case BB_VALUE_LIST:
+        {
+            oc_str8_list list = { 0 };
+
+            oc_str8_list_pushf(arena, &list, "(");
+            bb_value_for(value, child)
+            {
+                if(child != value + 1)
+                {
+                    oc_str8_list_pushf(arena, &list, " ");
+                }
+                oc_str8_list_push(arena, &list, bb_debug_value_to_str8(arena, child));
+            }
+            oc_str8_list_pushf(arena, &list, ")");
+            str = oc_str8_list_join(arena, list);
+        }
+        break;
+    }
+    return (str);
+}
+
+void bb_debug_print_facts(bb_facts_db* factDb)
+{
+    printf("Facts:\n");
+    i32 factIndex = 0;
+    oc_list_for(factDb->facts, fact, bb_fact, listElt)
+    {
+        printf("\tfact #%i:\n\t\t", factIndex);
+        bb_debug_print_value(fact->root);
+
+        printf("\n");
+        factIndex++;
+    }
+}
+
+bb_value* bb_program_match_pattern_against_value(bb_value* value, bb_value* pattern, bb_value** slots)
+{
+    //NOTE: if a placeholder appears several times in the pattern, its first occurrence binds it
+    bb_value* result = 0;
+    bool match = (value->kind == pattern->kind || pattern->kind == BB_VALUE_PLACEHOLDER);
+
+    if(match)
+    {
+        switch(pattern->kind)
+        {
+            case BB_VALUE_SYMBOL:
+            case BB_VALUE_STRING:
+                match = (value->atom == pattern->atom);
+                break;
+
+            case BB_VALUE_U64:
+            case BB_VALUE_CARD_ID:
+                match = (value->valU64 == pattern->valU64);
+                break;
+
+            case BB_VALUE_F64:
+                match = (value->valF64 == pattern->valF64);
+                break;
+
+            case BB_VALUE_LIST:
+            {
+                match = (value->count == pattern->count);
+
+                bb_value* child = value + 1;
+                bb_value_for(pattern, childPattern)
+                {
+                    if(!match)
+                    {
+                        break;
+                    }
+                    match = (bb_program_match_pattern_against_value(child, childPattern, slots) != 0);
+                    child += child->size;
+                }
+            }
+            break;
+
+            case BB_VALUE_PLACEHOLDER:
+            {
+                if(!slots[pattern->slot])
+                {
+                    slots[pattern->slot] = value;
+                }
+            }
+            break;
+        }
+        if(match)
+        {
+            result = value;
+        }
+    }
+
+    return result;
+}
+
+void bb_program_run_responder(bb_worker* worker, bb_responder* responder, bb_value* query)
+{
+    //NOTE: run a query against a responder
+    /*
+        e.g. we have a query (when self points up at $x), we want it to match the responder ($p points $dir at $q)
+
+        -> so we match the pattern of the _responder_ against the query, which returns the query with ($p = self, $dir = up, $q = $x),
+        and call the responder routine with this. It should check which pages self points up to, and return
+        (self points up at card-id) with ($x = card-id)
+    */
+    bb_value* slots[BB_BUILTIN_SLOT_COUNT] = { 0 };
+    bb_value* match = bb_program_match_pattern_against_value(query, responder->pattern, slots);
+    if(match)
+    {
+        if(worker->deferred)
+        {
+            oc_mutex_lock(worker->factDb->responderMutex);
+        }
+
+        //NOTE: answers don't depend on the names of the query's placeholders, so these are anonymized in the key.
+        //      The key is copied to the memo arena when recorded.
+        oc_arena_scope scope = oc_arena_scope_begin(&worker->scratchArena);
+        bb_value* key = bb_alpha_pattern_from_value(&worker->scratchArena, match);
+        u64 hash = bb_value_hash(key, 0);
+
+        if(!responder->memoBuckets)
+        {
+            responder->memoBuckets = oc_arena_push_array(&responder->memoArena, oc_list, BB_RESPONDER_MEMO_BUCKET_COUNT);
+            memset(responder->memoBuckets, 0, BB_RESPONDER_MEMO_BUCKET_COUNT * sizeof(oc_list));
+        }
+        oc_list* bucket = &responder->memoBuckets[hash & (BB_RESPONDER_MEMO_BUCKET_COUNT - 1)];
+
+        bb_memo_entry* entry = 0;
+        oc_list_for(*bucket, candidate, bb_memo_entry, bucketElt)
+        {
+            if(candidate->hash == hash && bb_value_equal(candidate->query, key))
+            {
+                entry = candidate;
+                break;
+            }
+        }
+
+        if(entry)
+        {
+            //NOTE: replay the answer. Its facts may have been retracted since it was recorded.
+            oc_list_for(entry->claims, claim, bb_claim, listElt)
+            {
+                bb_worker_claim(worker, claim->root, claim->claimer, claim->provenance);
+            }
+            oc_list_for(entry->effects, effect, bb_memo_effect, listElt)
+            {
+                *effect->frame = worker->factDb->frame;
+            }
+        }
+        else
+        {
+            entry = oc_arena_push_type(&responder->memoArena, bb_memo_entry);
+            memset(entry, 0, sizeof(bb_memo_entry));
+            entry->hash = hash;
+            entry->query = oc_arena_push_array(&responder->memoArena, bb_value, key->size);
+            memcpy(entry->query, key, key->size * sizeof(bb_value));
+            oc_list_push_back(bucket, &entry->bucketElt);
+
+            worker->memoResponder = responder;
+            worker->memoEntry = entry;
+            responder->proc(worker, match, slots);
+            worker->memoResponder = 0;
+            worker->memoEntry = 0;
+        }
+
+        oc_arena_scope_end(scope);
+
+        if(worker->deferred)
+        {
+            oc_mutex_unlock(worker->factDb->responderMutex);
+        }
+    }
+}
+
+void bb_responder_clear_memo(bb_responder* responder)
+{
+    oc_arena_clear(&responder->memoArena);
+    responder->memoBuckets = 0;
+}
+
+//------------------------------------------------------------------------------------------------
+// Compiled card code
+//------------------------------------------------------------------------------------------------
+
+//NOTE: cards are compiled into a list of statements when they are edited, so that the interpreter doesn't
+//      walk the cell tree and resolve names at each iteration. Patterns are flattened into templates, which
+//      are arrays of nodes in pre-order. Names bound by placeholders and variables are resolved at compile
+//      time to slots, which are indices into an array of values at runtime.
+
+enum
+{
+    BB_NO_SLOT = ~0U,
+};
+
+typedef enum
+{
+    BB_TEMPLATE_VALUE,       // constant value
+    BB_TEMPLATE_SLOT,        // value bound to slot, or symbol if the slot is not bound
+    BB_TEMPLATE_PLACEHOLDER, // placeholder, binds slot when matched
+    BB_TEMPLATE_LIST,        // list of the next count sub-templates
+    BB_TEMPLATE_OPERATOR,    // operator (in value.valU64) applied to the next count sub-templates
+} bb_template_op;
+
+typedef struct bb_template_node
+{
+    bb_template_op op;
+    u32 count;
+    u32 size; // number of nodes in this sub-template, including this one
+    u32 slot;
+    bb_value value;
+} bb_template_node;
+
+typedef struct bb_template
+{
+    u32 nodeCount;
+    bb_template_node* nodes;
+} bb_template;
+
+typedef enum
+{
+    BB_STMT_CLAIM,
+    BB_STMT_WHEN,
+    BB_STMT_VAR,
+    BB_STMT_SET,
+} bb_stmt_kind;
+
+typedef struct bb_stmt
+{
+    oc_list_elt listElt;
+    bb_stmt_kind kind;
+    bb_cell* cell;
+
+    bb_template pattern; // claimed fact, when pattern, or var/set value
+
+    //NOTE: when statements
+    bb_alpha_memory* memory;
+    oc_list body;
+    bool hasNestedWhen;
+    u32 firstSlot;
+    u32 slotCount;
+    bb_profile profile;
+
+    //NOTE: var and set statements
+    u32 slot;
+    bb_cell* valCell;
+    bb_bound_val* variable;
+    bool errorReported;
+
+} bb_stmt;
+
+struct bb_card_code
+{
+    oc_list statements;
+    u32 slotCount;
+
+    //NOTE: atoms acquired by the code, released when it is recompiled
+    oc_list atoms;
+};
+
+typedef struct bb_code_atom
+{
+    oc_list_elt listElt;
+    bb_atom atom;
+} bb_code_atom;
+
+typedef struct bb_compiler_name
+{
+    oc_list_elt listElt;
+    bb_atom name;
+    u32 slot;
+    bool isVar;
+} bb_compiler_name;
+
+typedef struct bb_compiler
+{
+    oc_arena* arena;
+    oc_arena* scratch;
+    bb_facts_db* factDb;
+    bb_card* card;
+    bb_card_code* code;
+
+    //NOTE: names in scope, from outermost to innermost
+    oc_list names;
+
+    //NOTE: when compiling a when pattern, placeholders bind new names starting at patternSlot
+    bool bindPlaceholders;
+    u32 patternSlot;
+} bb_compiler;
+
+u32 bb_cell_tree_count(bb_cell* cell)
+{
+    u32 count = 1;
+    oc_list_for(cell->children, child, bb_cell, parentElt)
+    {
+        count += bb_cell_tree_count(child);
+    }
+    return (count);
+}
+
+bb_compiler_name* bb_compiler_find_name(bb_compiler* compiler, bb_atom name)
+{
+    //NOTE: outer scopes take precedence over inner ones, and earlier names over later ones in the same scope
+    oc_list_for(compiler->names, entry, bb_compiler_name, listElt)
+    {
+        if(entry->name == name)
+        {
+            return (entry);
+        }
+    }
+    return (0);
+}
+
+bb_compiler_name* bb_compiler_push_name(bb_compiler* compiler, bb_atom name, bool isVar)
+{
+    bb_compiler_name* entry = oc_arena_push_type(compiler->scratch, bb_compiler_name);
+    memset(entry, 0, sizeof(bb_compiler_name));
+    entry->name = name;
+    entry->slot = compiler->code->slotCount++;
+    entry->isVar = isVar;
+    oc_list_push_back(&compiler->names, &entry->listElt);
+    return (entry);
+}
+
+void bb_compiler_pop_names(bb_compiler* compiler, u32 firstSlot)
+{
+    //NOTE: slots are never reused, so the names of a scope are the ones whose slot is at least its first slot
+    while(compiler->names.last)
+    {
+        bb_compiler_name* entry = oc_list_last_entry(compiler->names, bb_compiler_name, listElt);
+        if(entry->slot < firstSlot)
+        {
+            break;
+        }
+        oc_list_pop_back(&compiler->names);
+    }
+}
+
+bb_atom bb_compiler_atom(bb_compiler* compiler, bb_cell* cell)
+{
+    //NOTE: the atom is acquired by the code being compiled
+    bb_atom atom = BB_ATOM_NIL;
+    switch(cell->kind)
+    {
+        case BB_CELL_INT:
+        case BB_CELL_FLOAT:
+        case BB_CELL_LIST:
+            break;
+
+        case BB_CELL_PLACEHOLDER:
+            //NOTE: placeholder names are interned without the leading '$'
+            atom = bb_atom_acquire(oc_str8_slice(cell->text, 1, cell->text.len));
+            break;
+
+        default:
+            atom = bb_atom_acquire(cell->text);
+            break;
+    }
+
+    if(atom != BB_ATOM_NIL)
+    {
+        bb_code_atom* entry = oc_arena_push_type(compiler->arena, bb_code_atom);
+        entry->atom = atom;
+        oc_list_push_back(&compiler->code->atoms, &entry->listElt);
+    }
+    return (atom);
+}
+
+void bb_template_compile_cell(bb_compiler* compiler, bb_template* template, bb_cell* cell)
+{
+    u32 index = template->nodeCount;
+    bb_template_node* node = &template->nodes[index];
+    memset(node, 0, sizeof(bb_template_node));
+    node->value.size = 1;
+    template->nodeCount++;
+
+    if(cell->kind == BB_CELL_LIST)
+    {
+        bb_cell* head = oc_list_first_entry(cell->children, bb_cell, parentElt);
+        if(head && head->kind == BB_CELL_OPERATOR)
+        {
+            node->op = BB_TEMPLATE_OPERATOR;
+            node->value.valU64 = head->valU64;
+
+            //NOTE: operators only use their first two operands
+            for(bb_cell* operand = oc_list_next_entry(head, bb_cell, parentElt);
+                operand != 0 && node->count < 2;
+                operand = oc_list_next_entry(operand, bb_cell, parentElt))
+            {
+                bb_template_compile_cell(compiler, template, operand);
+                node->count++;
+            }
+        }
+        else
+        {
+            node->op = BB_TEMPLATE_LIST;
+            node->value.kind = BB_VALUE_LIST;
+            oc_list_for(cell->children, child, bb_cell, parentElt)
+            {
+                bb_template_compile_cell(compiler, template, child);
+                node->count++;
+            }
+        }
+    }
+    else if(cell->kind == BB_CELL_KEYWORD && cell->valU64 == BB_TOKEN_KW_SELF)
+    {
+        node->op = BB_TEMPLATE_VALUE;
+        node->value.kind = BB_VALUE_CARD_ID;
+        node->value.valU64 = compiler->card->id;
+    }
+    else if(cell->kind == BB_CELL_FLOAT)
+    {
+        node->op = BB_TEMPLATE_VALUE;
+        node->value.kind = BB_VALUE_F64;
+        node->value.valF64 = cell->valF64;
+    }
+    else if(cell->kind == BB_CELL_INT)
+    {
+        node->op = BB_TEMPLATE_VALUE;
+        node->value.kind = BB_VALUE_U64;
+        node->value.valU64 = cell->valU64;
+    }
+    else if(cell->kind == BB_CELL_STRING)
+    {
+        node->op = BB_TEMPLATE_VALUE;
+        node->value.kind = BB_VALUE_STRING;
+        node->value.atom = bb_compiler_atom(compiler, cell);
+    }
+    else if(cell->kind == BB_CELL_PLACEHOLDER)
+    {
+        bb_atom atom = bb_compiler_atom(compiler, cell);
+
+        node->op = BB_TEMPLATE_PLACEHOLDER;
+        node->value.kind = BB_VALUE_PLACEHOLDER;
+        node->value.atom = atom;
+        node->slot = BB_NO_SLOT;
+
+        if(compiler->bindPlaceholders)
+        {
+            //NOTE: if a name appears several times in the same pattern, only the first occurrence binds it
+            bool bound = false;
+            oc_list_for(compiler->names, entry, bb_compiler_name, listElt)
+            {
+                if(entry->name == atom && entry->slot >= compiler->patternSlot)
+                {
+                    bound = true;
+                    break;
+                }
+            }
+            if(!bound)
+            {
+                node->slot = bb_compiler_push_name(compiler, atom, false)->slot;
+            }
+        }
+    }
+    else
+    {
+        node->op = BB_TEMPLATE_VALUE;
+        node->value.kind = BB_VALUE_SYMBOL;
+        node->value.atom = bb_compiler_atom(compiler, cell);
+
+        //NOTE: names bound by the pattern being compiled are not visible in the pattern itself
+        bb_compiler_name* entry = bb_compiler_find_name(compiler, node->value.atom);
+        if(entry && !(compiler->bindPlaceholders && entry->slot >= compiler->patternSlot))
+        {
+            node->op = BB_TEMPLATE_SLOT;
+            node->slot = entry->slot;
+        }
+    }
+
+    node->size = template->nodeCount - index;
+}
+
+bb_template bb_template_compile(bb_compiler* compiler, bb_cell* cell)
+{
+    bb_template template = {
+        .nodes = oc_arena_push_array(compiler->arena, bb_template_node, bb_cell_tree_count(cell)),
+    };
+    bb_template_compile_cell(compiler, &template, cell);
+    return (template);
+}
+
+bb_template bb_template_compile_list(bb_compiler* compiler, bb_cell* first, u32 prefixCount, bb_value* prefix)
+{
+    //NOTE: compile a list made of a prefix of constant values, followed by the cells starting at first
+    u32 maxCount = 1 + prefixCount;
+    for(bb_cell* cell = first; cell != 0; cell = oc_list_next_entry(cell, bb_cell, parentElt))
+    {
+        maxCount += bb_cell_tree_count(cell);
+    }
+
+    bb_template template = {
+        .nodes = oc_arena_push_array(compiler->arena, bb_template_node, maxCount),
+    };
+
+    bb_template_node* root = &template.nodes[0];
+    memset(root, 0, sizeof(bb_template_node));
+    root->op = BB_TEMPLATE_LIST;
+    root->value.kind = BB_VALUE_LIST;
+    template.nodeCount = 1;
+
+    for(u32 i = 0; i < prefixCount; i++)
+    {
+        bb_template_node* node = &template.nodes[template.nodeCount];
+        memset(node, 0, sizeof(bb_template_node));
+        node->op = BB_TEMPLATE_VALUE;
+        node->size = 1;
+        node->value = prefix[i];
+        template.nodeCount++;
+        root->count++;
+    }
+
+    for(bb_cell* cell = first; cell != 0; cell = oc_list_next_entry(cell, bb_cell, parentElt))
+    {
+        bb_template_compile_cell(compiler, &template, cell);
+        root->count++;
+    }
+    root->size = template.nodeCount;
+
+    return (template);
+}
+
+bb_value* bb_template_alpha_pattern_into(bb_template_node* node, bb_value* out)
+{
+    //NOTE: writes the pattern of the alpha memory of a template. Only constants are kept, everything that
+    //      depends on slots becomes a placeholder. Returns the end of the written tuple.
+    bb_value* end = out + 1;
+
+    if(node->op == BB_TEMPLATE_LIST)
+    {
+        out->kind = BB_VALUE_LIST;
+        out->count = node->count;
+
+        bb_template_node* child = node + 1;
+        for(u32 i = 0; i < node->count; i++)
+        {
+            end = bb_template_alpha_pattern_into(child, end);
+            child += child->size;
+        }
+        out->size = end - out;
+    }
+    else if(node->op == BB_TEMPLATE_VALUE)
+    {
+        *out = node->value;
+    }
+    else
+    {
+        *out = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1 };
+    }
+    return (end);
+}
+
+bb_value* bb_template_alpha_pattern(oc_arena* arena, bb_template_node* node)
+{
+    //NOTE: the pattern has at most as many values as the template has nodes
+    bb_value* pattern = oc_arena_push_array(arena, bb_value, node->size);
+    bb_template_alpha_pattern_into(node, pattern);
+    return (pattern);
+}
+
+void bb_compile_statements(bb_compiler* compiler, oc_list* statements, bb_cell* first, bool topLevel);
+
+bb_stmt* bb_compile_statement(bb_compiler* compiler, bb_cell* cell, bool topLevel)
+{
+    if(cell->kind != BB_CELL_LIST || oc_list_empty(cell->children))
+    {
+        return (0);
+    }
+
+    bb_cell* head = oc_list_first_entry(cell->children, bb_cell, parentElt);
+    bb_cell* arg = oc_list_next_entry(head, bb_cell, parentElt);
+
+    bool valid = false;
+    if(head->kind == BB_CELL_KEYWORD)
+    {
+        switch(head->valU64)
+        {
+            case BB_TOKEN_KW_CLAIM:
+            case BB_TOKEN_KW_WISH:
+            case BB_TOKEN_KW_SET:
+                valid = true;
+                break;
+
+            case BB_TOKEN_KW_WHEN:
+                valid = (arg != 0);
+                break;
+
+            case BB_TOKEN_KW_VAR:
+                valid = (arg != 0 && arg->kind == BB_CELL_SYMBOL);
+                break;
+        }
+    }
+    if(!valid)
+    {
+        return (0);
+    }
+
+    bb_stmt* stmt = oc_arena_push_type(compiler->arena, bb_stmt);
+    memset(stmt, 0, sizeof(bb_stmt));
+    stmt->cell = cell;
+    stmt->slot = BB_NO_SLOT;
+
+    switch(head->valU64)
+    {
+        case BB_TOKEN_KW_CLAIM:
+        {
+            stmt->kind = BB_STMT_CLAIM;
+            stmt->pattern = bb_template_compile_list(compiler, arg, 0, 0);
+        }
+        break;
+
+        case BB_TOKEN_KW_WISH:
+        {
+            //NOTE: equivalent to  (claim self wishes ...)
+            bb_value prefix[2] = {
+                { .kind = BB_VALUE_CARD_ID, .size = 1, .valU64 = compiler->card->id },
+                { .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_WISHES },
+            };
+            stmt->kind = BB_STMT_CLAIM;
+            stmt->pattern = bb_template_compile_list(compiler, arg, 2, prefix);
+        }
+        break;
+
+        case BB_TOKEN_KW_WHEN:
+        {
+            stmt->kind = BB_STMT_WHEN;
+            stmt->firstSlot = compiler->code->slotCount;
+
+            compiler->bindPlaceholders = true;
+            compiler->patternSlot = stmt->firstSlot;
+            stmt->pattern = bb_template_compile(compiler, arg);
+            compiler->bindPlaceholders = false;
+
+            stmt->slotCount = compiler->code->slotCount - stmt->firstSlot;
+
+            bb_value* alphaPattern = bb_template_alpha_pattern(compiler->scratch, stmt->pattern.nodes);
+            stmt->memory = bb_alpha_memory_acquire(compiler->factDb, alphaPattern);
+
+            bb_compile_statements(compiler, &stmt->body, oc_list_next_entry(arg, bb_cell, parentElt), false);
+
+            oc_list_for(stmt->body, child, bb_stmt, listElt)
+            {
+                if(child->kind == BB_STMT_WHEN)
+                {
+                    stmt->hasNestedWhen = true;
+                }
+            }
+            bb_compiler_pop_names(compiler, stmt->firstSlot);
+        }
+        break;
+
+        case BB_TOKEN_KW_VAR:
+        {
+            stmt->kind = BB_STMT_VAR;
+            bb_atom name = bb_compiler_atom(compiler, arg);
+            stmt->valCell = oc_list_next_entry(arg, bb_cell, parentElt);
+            if(stmt->valCell)
+            {
+                stmt->pattern = bb_template_compile(compiler, stmt->valCell);
+            }
+
+            if(topLevel)
+            {
+                //NOTE: top-level variables persist across frames and edits
+                oc_list_for(compiler->card->variables, var, bb_bound_val, cardElt)
+                {
+                    if(var->name == name)
+                    {
+                        stmt->variable = var;
+                        break;
+                    }
+                }
+                if(!stmt->variable)
+                {
+                    bb_bound_val* variable = oc_arena_push_type(&compiler->factDb->persistentArena, bb_bound_val);
+                    memset(variable, 0, sizeof(bb_bound_val));
+                    //NOTE: variables outlive the code, so they hold their own reference to their name
+                    variable->name = name;
+                    bb_atom_retain(name);
+                    variable->value = &variable->storedValue;
+                    *variable->value = (bb_value){ .kind = BB_VALUE_U64, .size = 1 };
+                    oc_list_push_back(&compiler->card->variables, &variable->cardElt);
+
+                    stmt->variable = variable;
+                }
+            }
+            stmt->slot = bb_compiler_push_name(compiler, name, true)->slot;
+        }
+        break;
+
+        case BB_TOKEN_KW_SET:
+        {
+            //NOTE: set statements that don't name a variable in scope do nothing, but still count as
+            //      the card's set for this frame
+            stmt->kind = BB_STMT_SET;
+            if(arg && arg->kind == BB_CELL_SYMBOL)
+            {
+                bb_cell* valCell = oc_list_next_entry(arg, bb_cell, parentElt);
+                bb_compiler_name* entry = bb_compiler_find_name(compiler, bb_compiler_atom(compiler, arg));
+                if(valCell && entry && entry->isVar)
+                {
+                    stmt->slot = entry->slot;
+                    stmt->pattern = bb_template_compile(compiler, valCell);
+                }
+            }
+        }
+        break;
+    }
+    return (stmt);
+}
+
+void bb_compile_statements(bb_compiler* compiler, oc_list* statements, bb_cell* first, bool topLevel)
+{
+    for(bb_cell* cell = first; cell != 0; cell = oc_list_next_entry(cell, bb_cell, parentElt))
+    {
+        bb_stmt* stmt = bb_compile_statement(compiler, cell, topLevel);
+        if(stmt)
+        {
+            oc_list_push_back(statements, &stmt->listElt);
+        }
+    }
+}
+
+void bb_stmt_list_release(bb_facts_db* factDb, oc_list statements)
+{
+    oc_list_for(statements, stmt, bb_stmt, listElt)
+    {
+        if(stmt->memory)
+        {
+            bb_alpha_memory_release(factDb, stmt->memory);
+            stmt->memory = 0;
+        }
+        bb_stmt_list_release(factDb, stmt->body);
+    }
+}
+
+void bb_card_release_code(bb_facts_db* factDb, bb_card* card)
+{
+    //NOTE: release the alpha memories and atoms of a card's statements. The code must be recompiled before
+    //      running again.
+    if(card->code)
+    {
+        bb_stmt_list_release(factDb, card->code->statements);
+        oc_list_for(card->code->atoms, entry, bb_code_atom, listElt)
+        {
+            bb_atom_release(entry->atom);
+        }
+        oc_list_init(&card->code->atoms);
+    }
+}
+
+void bb_card_compile(bb_facts_db* factDb, bb_card* card)
+{
+    if(!card->code)
+    {
+        oc_arena_init(&card->codeArena);
+    }
+    else
+    {
+        bb_card_release_code(factDb, card);
+        oc_arena_clear(&card->codeArena);
+    }
+
+    oc_arena_scope scratch = oc_scratch_begin();
+
+    bb_card_code* code = oc_arena_push_type(&card->codeArena, bb_card_code);
+    memset(code, 0, sizeof(bb_card_code));
+
+    bb_compiler compiler = {
+        .arena = &card->codeArena,
+        .scratch = scratch.arena,
+        .factDb = factDb,
+        .card = card,
+        .code = code,
+    };
+    bb_compile_statements(&compiler, &code->statements, oc_list_first_entry(card->root->children, bb_cell, parentElt), true);
+
+    oc_scratch_end(scratch);
+
+    card->code = code;
+}
+
+bb_value bb_program_eval_operator(bb_token op, bb_value* lhs, bb_value* rhs)
+{
+    //NOTE: operators that can't be applied evaluate to a zeroed value
+    bb_value result = { 0 };
+
+    if((op == BB_TOKEN_OP_ADD || op == BB_TOKEN_OP_SUB) && lhs)
+    {
+        if(rhs)
+        {
+            if(lhs->kind == BB_VALUE_F64 || rhs->kind == BB_VALUE_F64)
+            {
+                f64 lhsValue = lhs->valF64;
+                f64 rhsValue = rhs->valF64;
+                if(lhs->kind == BB_VALUE_U64)
+                {
+                    lhsValue = (f64)lhs->valU64;
+                }
+                if(rhs->kind == BB_VALUE_U64)
+                {
+                    rhsValue = (f64)rhs->valU64;
+                }
+                result.kind = BB_VALUE_F64;
+                if(op == BB_TOKEN_OP_ADD)
+                {
+                    result.valF64 = lhsValue + rhsValue;
+                }
+                else
+                {
+                    result.valF64 = lhsValue - rhsValue;
+                }
+            }
+            else
+            {
+                result.kind = BB_VALUE_U64;
+                if(op == BB_TOKEN_OP_ADD)
+                {
+                    result.valU64 = lhs->valU64 + rhs->valU64;
+                }
+                else
+                {
+                    result.valU64 = lhs->valU64 - rhs->valU64;
+                }
+            }
+        }
+        else if(op == BB_TOKEN_OP_SUB)
+        {
+            if(lhs->kind == BB_VALUE_F64)
+            {
+                result.kind = BB_VALUE_F64;
+                result.valF64 = -lhs->valF64;
+            }
+            else
+            {
+                result.kind = BB_VALUE_U64;
+                result.valU64 = -lhs->valU64;
+            }
+        }
+    }
+    return (result);
+}
+
+bb_value bb_template_eval_scalar(bb_template_node* node, bb_value** slots)
+{
+    //NOTE: evaluates a template to a single value, without building lists. This is enough for operands
+    //      and operator results, which are always scalars.
+    bb_value result = { 0 };
+
+    switch(node->op)
+    {
+        case BB_TEMPLATE_VALUE:
+        case BB_TEMPLATE_PLACEHOLDER:
+            result = node->value;
+            break;
+
+        case BB_TEMPLATE_SLOT:
+            result = slots[node->slot] ? *slots[node->slot] : node->value;
+            break;
+
+        case BB_TEMPLATE_LIST:
+            result.kind = BB_VALUE_LIST;
+            break;
+
+        case BB_TEMPLATE_OPERATOR:
+        {
+            bb_value operands[2] = { 0 };
+            bb_template_node* operand = node + 1;
+            for(u32 i = 0; i < node->count; i++)
+            {
+                operands[i] = bb_template_eval_scalar(operand, slots);
+                operand += operand->size;
+            }
+            result = bb_program_eval_operator(node->value.valU64,
+                                              node->count > 0 ? &operands[0] : 0,
+                                              node->count > 1 ? &operands[1] : 0);
+        }
+        break;
+    }
+    result.size = 1;
+    return (result);
+}
+
+u32 bb_template_eval_size(bb_template_node* node, bb_value** slots)
+{
+    u32 size = 1;
+    if(node->op == BB_TEMPLATE_SLOT && slots[node->slot])
+    {
+        size = slots[node->slot]->size;
+    }
+    else if(node->op == BB_TEMPLATE_LIST)
+    {
+        bb_template_node* child = node + 1;
+        for(u32 i = 0; i < node->count; i++)
+        {
+            size += bb_template_eval_size(child, slots);
+            child += child->size;
+        }
+    }
+    return (size);
+}
+
+bb_value* bb_template_eval_into(bb_template_node* node, bb_value** slots, bb_value* out)
+{
+    //NOTE: writes the value of a template to out, and returns the end of the written tuple
+    bb_value* end = out + 1;
+
+    if(node->op == BB_TEMPLATE_SLOT && slots[node->slot])
+    {
+        bb_value* value = slots[node->slot];
+        memcpy(out, value, value->size * sizeof(bb_value));
+        end = out + value->size;
+    }
+    else if(node->op == BB_TEMPLATE_LIST)
+    {
+        out->kind = BB_VALUE_LIST;
+        out->count = node->count;
+
+        bb_template_node* child = node + 1;
+        for(u32 i = 0; i < node->count; i++)
+        {
+            end = bb_template_eval_into(child, slots, end);
+            child += child->size;
+        }
+        out->size = end - out;
+    }
+    else
+    {
+        *out = bb_template_eval_scalar(node, slots);
+    }
+    return (end);
+}
+
+bb_value* bb_template_eval(oc_arena* arena, bb_template_node* node, bb_value** slots)
+{
+    bb_value* result = oc_arena_push_array(arena, bb_value, bb_template_eval_size(node, slots));
+    bb_template_eval_into(node, slots, result);
+    return (result);
+}
+
+bool bb_template_match(bb_template_node* node, bb_value* value, bb_value** slots)
+{
+    //NOTE: matches a fact value directly against a template, writing the values bound by placeholders to slots
+    bool match = false;
+
+    switch(node->op)
+    {
+        case BB_TEMPLATE_VALUE:
+            match = bb_value_equal(value, &node->value);
+            break;
+
+        case BB_TEMPLATE_SLOT:
+            match = bb_value_match(value, slots[node->slot] ? slots[node->slot] : &node->value);
+            break;
+
+        case BB_TEMPLATE_PLACEHOLDER:
+        {
+            if(node->slot != BB_NO_SLOT)
+            {
+                slots[node->slot] = value;
+            }
+            match = true;
+        }
+        break;
+
+        case BB_TEMPLATE_LIST:
+        {
+            if(value->kind == BB_VALUE_LIST && value->count == node->count)
+            {
+                bb_template_node* child = node + 1;
+                match = true;
+                bb_value_for(value, childVal)
+                {
+                    if(!bb_template_match(child, childVal, slots))
+                    {
+                        match = false;
+                        break;
+                    }
+                    child += child->size;
+                }
+            }
+        }
+        break;
+
+        case BB_TEMPLATE_OPERATOR:
+        {
+            bb_value result = bb_template_eval_scalar(node, slots);
+            match = bb_value_match(value, &result);
+        }
+        break;
+    }
+    return (match);
+}
+
+typedef struct bb_stmt_match
+{
+    oc_list_elt listElt;
+    u64 iteration;
+    bb_fact* fact;   // matched fact, or 0 if the match is a claim deferred during a parallel pass
+    bb_claim* claim; // matched deferred claim
+    bb_value** slots;
+} bb_stmt_match;
+
+void bb_profile_add(bb_profile* profile, u32 frame, bb_profile_counters* counters)
+{
+    //NOTE: the counters of the last frame are reset lazily, so that cards that aren't evaluated cost nothing
+    if(profile->frame != frame)
+    {
+        memset(&profile->last, 0, sizeof(bb_profile_counters));
+        profile->frame = frame;
+    }
+
+    bb_profile_counters* dst[2] = { &profile->last, &profile->total };
+    for(u32 i = 0; i < 2; i++)
+    {
+        dst[i]->evaluations += counters->evaluations;
+        dst[i]->factsScanned += counters->factsScanned;
+        dst[i]->matches += counters->matches;
+        dst[i]->factsProduced += counters->factsProduced;
+        dst[i]->nanoseconds += counters->nanoseconds;
+    }
+}
+
+void bb_program_exec_stmt(bb_worker* worker, bb_card* card, bb_stmt* stmt, bb_value** slots, bb_provenance provenance, u64 deltaIteration)
+{
+    //NOTE: semi-naive evaluation. The current bindings have already been evaluated against all facts older
+    //      than deltaIteration, so when patterns only need to be joined against newer facts. A deltaIteration
+    //      of 0 means the bindings are fresh, ie. they have not been evaluated yet and can produce new facts.
+    //      Facts produced under some bindings depend on the card that produces them and on all the facts that
+    //      were matched to get these bindings, which is tracked by provenance.
+    bool fresh = (deltaIteration == 0);
+    bb_facts_db* factDb = worker->factDb;
+    oc_arena* arena = &worker->scratchArena;
+
+    switch(stmt->kind)
+    {
+        case BB_STMT_CLAIM:
+        {
+            //NOTE: claims with bindings that aren't fresh would only re-push existing facts. The fact is copied
+            //      when it is pushed or deferred, so it only lives in a scratch scope.
+            if(fresh)
+            {
+                oc_arena_scope scope = oc_arena_scope_begin(arena);
+                bb_value* fact = bb_template_eval(arena, stmt->pattern.nodes, slots);
+                bb_worker_claim(worker, fact, card, provenance);
+                worker->factsClaimed++;
+                oc_arena_scope_end(scope);
+            }
+        }
+        break;
+
+        case BB_STMT_WHEN:
+        {
+            f64 startTime = factDb->profiling ? oc_clock_time(OC_CLOCK_MONOTONIC) : 0;
+            u64 scannedBefore = worker->factsScanned;
+            u64 claimedBefore = worker->factsClaimed;
+            u64 matchCount = 0;
+
+            //NOTE: the query, matches and values produced by the body only live until the end of the when
+            oc_arena_scope scope = oc_arena_scope_begin(arena);
+
+            //NOTE: if the bindings are fresh, join against all facts. Otherwise only matches against
+            //      the delta are fresh. Old matches still need to be visited if the body contains
+            //      nested whens, which can then join the delta with these (old) bindings.
+            u64 minIteration = 0;
+            if(!fresh && !stmt->hasNestedWhen)
+            {
+                minIteration = deltaIteration;
+            }
+
+            bb_template_node* pattern = stmt->pattern.nodes;
+
+            //NOTE: only build the query value if a responder can match it
+            bb_claim* lastClaim = worker->deferred ? oc_list_last_entry(*worker->claims, bb_claim, listElt) : 0;
+            bb_value* query = 0;
+            oc_list_for(factDb->responders, responder, bb_responder, listElt)
+            {
+                if(pattern->op == BB_TEMPLATE_LIST && responder->pattern->count == pattern->count)
+                {
+                    if(!query)
+                    {
+                        query = bb_template_eval(arena, pattern, slots);
+                    }
+                    bb_program_run_responder(worker, responder, query);
+                }
+            }
+
+            //NOTE: elements that depend on slots are only known now. Probe their argument indexes, and scan the
+            //      smallest of these and the alpha memory.
+            bb_fact_list empty = { 0 };
+            bb_fact_list* facts = &stmt->memory->facts;
+
+            if(pattern->op == BB_TEMPLATE_LIST)
+            {
+                bb_template_node* child = pattern + 1;
+                for(u32 position = 0; position < pattern->count && facts->count; position++)
+                {
+                    if(child->op == BB_TEMPLATE_SLOT || child->op == BB_TEMPLATE_OPERATOR)
+                    {
+                        bb_value value = bb_template_eval_scalar(child, slots);
+                        if(bb_value_is_indexed(&value))
+                        {
+                            bb_arg_index* index = bb_arg_index_find(factDb, bb_alpha_key(pattern->count, position, bb_value_hash(&value, 0)));
+                            if(!index)
+                            {
+                                facts = &empty;
+                            }
+                            else if(index->facts.count < facts->count)
+                            {
+                                facts = &index->facts;
+                            }
+                        }
+                    }
+                    child += child->size;
+                }
+            }
+
+            //NOTE: collect matches before running the body, which can add new facts
+            oc_list matches = { 0 };
+            for(bb_fact_entry* entry = bb_fact_list_first_since(worker, facts, minIteration);
+                entry != 0;
+                entry = oc_list_next_entry(entry, bb_fact_entry, listElt))
+            {
+                if(bb_template_match(pattern, entry->fact->root, slots))
+                {
+                    bb_stmt_match* match = oc_arena_push_type(arena, bb_stmt_match);
+                    memset(match, 0, sizeof(bb_stmt_match));
+                    match->iteration = entry->fact->iteration;
+                    match->fact = entry->fact;
+                    match->slots = oc_arena_push_array(arena, bb_value*, stmt->slotCount);
+                    memcpy(match->slots, slots + stmt->firstSlot, stmt->slotCount * sizeof(bb_value*));
+                    oc_list_push_back(&matches, &match->listElt);
+                    matchCount++;
+                }
+            }
+
+            if(worker->deferred)
+            {
+                //NOTE: during a parallel pass, the answers of responders are only pushed to the db at the end
+                //      of the pass. Match the new ones now, as if they had been pushed.
+                bb_claim* claim = lastClaim
+                                    ? oc_list_next_entry(lastClaim, bb_claim, listElt)
+                                    : oc_list_first_entry(*worker->claims, bb_claim, listElt);
+                for(; claim != 0; claim = oc_list_next_entry(claim, bb_claim, listElt))
+                {
+                    if(!bb_fact_db_find(factDb, claim->root, bb_value_hash(claim->root, 0))
+                       && bb_template_match(pattern, claim->root, slots))
+                    {
+                        bb_stmt_match* match = oc_arena_push_type(arena, bb_stmt_match);
+                        memset(match, 0, sizeof(bb_stmt_match));
+                        match->iteration = factDb->iteration;
+                        match->claim = claim;
+                        match->slots = oc_arena_push_array(arena, bb_value*, stmt->slotCount);
+                        memcpy(match->slots, slots + stmt->firstSlot, stmt->slotCount * sizeof(bb_value*));
+                        oc_list_push_back(&matches, &match->listElt);
+                        matchCount++;
+                    }
+                }
+            }
+
+            oc_list_for(matches, match, bb_stmt_match, listElt)
+            {
+                memcpy(slots + stmt->firstSlot, match->slots, stmt->slotCount * sizeof(bb_value*));
+
+                u64 matchDelta = (match->iteration >= deltaIteration) ? 0 : deltaIteration;
+
+                bb_provenance matchProvenance = { 0 };
+                if(match->fact)
+                {
+                    matchProvenance = bb_provenance_copy(arena, provenance, match->fact->supportCount);
+                    oc_list_for(match->fact->supports, support, bb_support, factElt)
+                    {
+                        bb_provenance_add(&matchProvenance, support->card, support->inputs);
+                    }
+                }
+                else
+                {
+                    bb_provenance* claimProvenance = &match->claim->provenance;
+                    matchProvenance = bb_provenance_copy(arena, provenance, claimProvenance->count);
+                    for(u32 i = 0; i < claimProvenance->count; i++)
+                    {
+                        bb_provenance_add(&matchProvenance, claimProvenance->deps[i].card, claimProvenance->deps[i].inputs);
+                    }
+                }
+
+                oc_list_for(stmt->body, child, bb_stmt, listElt)
+                {
+                    bb_program_exec_stmt(worker, card, child, slots, matchProvenance, matchDelta);
+                }
+            }
+
+            oc_arena_scope_end(scope);
+
+            if(factDb->profiling)
+            {
+                bb_profile_counters counters = {
+                    .evaluations = 1,
+                    .factsScanned = worker->factsScanned - scannedBefore,
+                    .matches = matchCount,
+                    .factsProduced = worker->factsClaimed - claimedBefore,
+                    .nanoseconds = (oc_clock_time(OC_CLOCK_MONOTONIC) - startTime) * 1e9,
+                };
+                bb_profile_add(&stmt->profile, factDb->frame, &counters);
+            }
+        }
+        break;
+
+        case BB_STMT_VAR:
+        {
+            bb_value* value = 0;
+            if(stmt->variable)
+            {
+                value = stmt->variable->value;
+            }
+            else
+            {
+                value = oc_arena_push_type(arena, bb_value);
+                *value = (bb_value){ .kind = BB_VALUE_U64, .size = 1 };
+            }
+
+            //NOTE: variables are (re)initialized when their initial value is edited
+            if(stmt->valCell && stmt->valCell->lastEdit == factDb->frame)
+            {
+                bb_value* val = bb_template_eval(arena, stmt->pattern.nodes, slots);
+                if(val->kind == BB_VALUE_U64 || val->kind == BB_VALUE_F64 || val->kind == BB_VALUE_STRING)
+                {
+                    *value = *val;
+                }
+            }
+            slots[stmt->slot] = value;
+        }
+        break;
+
+        case BB_STMT_SET:
+        {
+            if(stmt->cell->lastFrame < factDb->frame)
+            {
+                stmt->cell->lastFrame = factDb->frame;
+
+                if(stmt->slot != BB_NO_SLOT && slots[stmt->slot])
+                {
+                    //NOTE: variables hold a single value, so they can't be set to a list. This is reported once
+                    //      per compilation of the statement, since stateful cards run every frame.
+                    oc_arena_scope scope = oc_arena_scope_begin(arena);
+                    bb_value* val = bb_template_eval(arena, stmt->pattern.nodes, slots);
+                    bb_value* var = slots[stmt->slot];
+                    if(val->kind == BB_VALUE_LIST)
+                    {
+                        if(!stmt->errorReported)
+                        {
+                            bb_cell* name = bb_cell_next_sibling(bb_cell_first_child(stmt->cell));
+                            oc_log_error("card-%u: can't set variable '%.*s' to a list\n", card->id, oc_str8_ip(name->text));
+                            stmt->errorReported = true;
+                        }
+                    }
+                    else if(!bb_value_equal(var, val))
+                    {
+                        *var = *val;
+
+                        //NOTE: old bindings can now produce different facts, so the card needs a full pass
+                        card->varsChanged = true;
+                    }
+                    oc_arena_scope_end(scope);
+                }
+            }
+        }
+        break;
+    }
+
+    //NOTE: during a parallel pass, the iteration is only advanced when claims are merged
+    if(!worker->deferred)
+    {
+        factDb->iteration++;
+    }
+}
+
+void bb_builtin_listener_label(bb_value* match, bb_value** slots, bb_facts_db* factDb, oc_list cards)
+{
+    bb_value* q = slots[BB_BUILTIN_SLOT_Q];
+    bb_value* s = slots[BB_BUILTIN_SLOT_S];
+
+    if(q && s && q->kind == BB_VALUE_CARD_ID)
+    {
+        oc_list_for(cards, card, bb_card, listElt)
+        {
+            if(card->id == q->valU64)
+            {
+                //NOTE: labels are copied or formatted into the string store, since the atom of a string can be
+                //      freed while the label is carried over. The card holds a reference to its label until it
+                //      is replaced.
+                bb_string* labelString = 0;
+                if(s->kind == BB_VALUE_STRING)
+                {
+                    labelString = bb_string_acquire(&factDb->strings, bb_atom_string(s->atom));
+
+                    card->label = labelString->string;
+                    card->labelFrame = factDb->frame;
+                }
+                else if(s->kind == BB_VALUE_U64 || s->kind == BB_VALUE_F64)
+                {
+                    oc_arena_scope scratch = oc_scratch_begin();
+                    oc_str8 str = (s->kind == BB_VALUE_U64)
+                                    ? oc_str8_pushf(scratch.arena, "%" PRIu64, s->valU64)
+                                    : oc_str8_pushf(scratch.arena, "%f", s->valF64);
+                    labelString = bb_string_acquire(&factDb->strings, str);
+                    oc_scratch_end(scratch);
+
+                    card->label = labelString->string;
+                    card->labelFrame = factDb->frame;
+                }
+                else
+                {
+                    continue;
+                }
+
+                if(card->labelString)
+                {
+                    bb_string_release(&factDb->strings, card->labelString);
+                }
+                card->labelString = labelString;
+            }
+        }
+    }
+}
+
+void bb_builtin_listener_label_carry(bb_facts_db* factDb, bb_card* card)
+{
+    if(card->labelFrame == factDb->frame - 1)
+    {
+        card->labelFrame = factDb->frame;
+    }
+}
+
+typedef struct bb_color_entry
+{
+    oc_str8 string;
+    oc_color color;
+} bb_color_entry;
+
+const bb_color_entry bb_highlight_colors[] = {
+    {
+        OC_STR8_LIT("red"),
+        { 1, 0, 0, 1 },
+    },
+    {
+        OC_STR8_LIT("green"),
+        { 0, 1, 0, 1 },
+    },
+    {
+        OC_STR8_LIT("blue"),
+        { 0, 0, 1, 1 },
+    },
+    {
+        OC_STR8_LIT("yellow"),
+        { 1, 1, 0, 1 },
+    },
+    {
+        OC_STR8_LIT("cyan"),
+        { 0, 1, 1, 1 },
+    },
+    {
+        OC_STR8_LIT("magenta"),
+        { 1, 0, 1, 1 },
+    },
+    {
+        OC_STR8_LIT("orange"),
+        { 1, 0.647, 0, 1, OC_COLOR_SPACE_SRGB },
+    },
+};
+const u32 bb_highlight_color_count = sizeof(bb_highlight_colors) / sizeof(bb_color_entry);
+
+void bb_builtin_listener_highlight(bb_value* match, bb_value** slots, bb_facts_db* factDb, oc_list cards)
+{
+    bb_value* q = slots[BB_BUILTIN_SLOT_Q];
+    bb_value* s = slots[BB_BUILTIN_SLOT_S];
+
+    if(q && s && q->kind == BB_VALUE_CARD_ID && s->kind == BB_VALUE_STRING)
+    {
+        oc_color color = { 0 };
+        bool found = false;
+        for(u32 i = 0; i < bb_highlight_color_count; i++)
+        {
+            if(!oc_str8_cmp(bb_atom_string(s->atom), bb_highlight_colors[i].string))
+            {
+                color = bb_highlight_colors[i].color;
+                found = true;
+                break;
+            }
+        }
+
+        if(found)
+        {
+            oc_list_for(cards, card, bb_card, listElt)
+            {
+                if(card->id == q->valU64)
+                {
+                    card->highlight = color;
+                    card->highlightFrame = factDb->frame;
+                }
+            }
+        }
+    }
+}
+
+void bb_builtin_listener_highlight_carry(bb_facts_db* factDb, bb_card* card)
+{
+    if(card->highlightFrame == factDb->frame - 1)
+    {
+        card->highlightFrame = factDb->frame;
+    }
+}
+
+void bb_program_init_builtin_listeners(oc_arena* arena, bb_facts_db* factDb)
+{
+    {
+        bb_listener* listener = oc_arena_push_type(arena, bb_listener);
+        memset(listener, 0, sizeof(bb_listener));
+
+        bb_value* pattern = oc_arena_push_array(arena, bb_value, 7);
+        pattern[0] = (bb_value){ .kind = BB_VALUE_LIST, .size = 7, .count = 6 };
+        pattern[1] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_P, .slot = BB_BUILTIN_SLOT_P };
+        pattern[2] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_WISHES };
+        pattern[3] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_Q, .slot = BB_BUILTIN_SLOT_Q };
+        pattern[4] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_IS };
+        pattern[5] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_LABELED };
+        pattern[6] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_S, .slot = BB_BUILTIN_SLOT_S };
+
+        listener->pattern = pattern;
+        listener->proc = bb_builtin_listener_label;
+        listener->carry = bb_builtin_listener_label_carry;
+
+        oc_list_push_back(&factDb->listeners, &listener->listElt);
+    }
+
+    {
+        bb_listener* listener = oc_arena_push_type(arena, bb_listener);
+        memset(listener, 0, sizeof(bb_listener));
+
+        bb_value* pattern = oc_arena_push_array(arena, bb_value, 7);
+        pattern[0] = (bb_value){ .kind = BB_VALUE_LIST, .size = 7, .count = 6 };
+        pattern[1] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_P, .slot = BB_BUILTIN_SLOT_P };
+        pattern[2] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_WISHES };
+        pattern[3] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_Q, .slot = BB_BUILTIN_SLOT_Q };
+        pattern[4] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_IS };
+        pattern[5] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_HIGHLIGHTED };
+        pattern[6] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_S, .slot = BB_BUILTIN_SLOT_S };
+
+        listener->pattern = pattern;
+        listener->proc = bb_builtin_listener_highlight;
+        listener->carry = bb_builtin_listener_highlight_carry;
+
+        oc_list_push_back(&factDb->listeners, &listener->listElt);
+    }
+}
+
+void bb_program_run_builtin_listeners(bb_worker* worker, oc_list cards)
+{
+    bb_facts_db* factDb = worker->factDb;
+    oc_arena* arena = worker->arena;
+
+    oc_list_for(factDb->listeners, listener, bb_listener, listElt)
+    {
+        if(!listener->memory)
+        {
+            oc_arena_scope scratch = oc_scratch_begin_next(arena);
+            listener->memory = bb_alpha_memory_acquire(factDb, bb_alpha_pattern_from_value(scratch.arena, listener->pattern));
+            oc_scratch_end(scratch);
+        }
+
+        oc_list_for(factDb->responders, responder, bb_responder, listElt)
+        {
+            bb_program_run_responder(worker, responder, listener->pattern);
+        }
+
+        for(bb_fact_entry* entry = bb_fact_list_first_since(worker, &listener->memory->facts, listener->lastRun + 1);
+            entry != 0;
+            entry = oc_list_next_entry(entry, bb_fact_entry, listElt))
+        {
+            bb_value* slots[BB_BUILTIN_SLOT_COUNT] = { 0 };
+            if(bb_program_match_pattern_against_value(entry->fact->root, listener->pattern, slots))
+            {
+                listener->proc(entry->fact->root, slots, factDb, cards);
+            }
+        }
+        listener->lastRun = factDb->iteration;
+        listener->removeCount = listener->memory->removeCount;
+        factDb->iteration++;
+    }
+}
+
+//------------------------------------------------------------------------------------------------
+// Card grid
+//------------------------------------------------------------------------------------------------
+
+//NOTE: each card is put in all the cells of the grid its rect overlaps. Cells are hashed into a fixed number
+//      of buckets, so entries of a bucket must be filtered by cell coordinates. Entries are pushed in card
+//      order, so that queries return cards in the same order as the card list. The grid also indexes cards
+//      by id, using the same entries with their cell coordinates unused.
+
+i32 bb_card_grid_coord(f32 x)
+{
+    return ((i32)floorf(x / BB_CARD_GRID_CELL_SIZE));
+}
+
+u32 bb_card_grid_bucket_index(bb_card_grid* grid, i32 x, i32 y)
+{
+    u64 hash = ((u64)(u32)x * 0x9E3779B97F4A7C15ULL) ^ ((u64)(u32)y * 0xC2B2AE3D27D4EB4FULL);
+    return ((hash >> 32) & (grid->bucketCount - 1));
+}
+
+void bb_card_grid_build(bb_card_grid* grid, oc_list cards)
+{
+    if(!grid->buckets)
+    {
+        oc_arena_init(&grid->arena);
+    }
+    else
+    {
+        oc_arena_clear(&grid->arena);
+    }
+
+    u32 entryCount = 0;
+    u32 cardCount = 0;
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        cardCount++;
+        u32 w = bb_card_grid_coord(card->rect.x + card->rect.w) - bb_card_grid_coord(card->rect.x) + 1;
+        u32 h = bb_card_grid_coord(card->rect.y + card->rect.h) - bb_card_grid_coord(card->rect.y) + 1;
+        entryCount += w * h;
+    }
+
+    grid->bucketCount = BB_FACT_DB_MIN_BUCKET_COUNT;
+    while(grid->bucketCount < entryCount)
+    {
+        grid->bucketCount *= 2;
+    }
+    grid->buckets = oc_arena_push_array(&grid->arena, oc_list, grid->bucketCount);
+    memset(grid->buckets, 0, grid->bucketCount * sizeof(oc_list));
+
+    grid->idBucketCount = BB_FACT_DB_MIN_BUCKET_COUNT;
+    while(grid->idBucketCount < cardCount)
+    {
+        grid->idBucketCount *= 2;
+    }
+    grid->idBuckets = oc_arena_push_array(&grid->arena, oc_list, grid->idBucketCount);
+    memset(grid->idBuckets, 0, grid->idBucketCount * sizeof(oc_list));
+
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        bb_card_grid_entry* idEntry = oc_arena_push_type(&grid->arena, bb_card_grid_entry);
+        idEntry->card = card;
+        oc_list_push_back(&grid->idBuckets[card->id & (grid->idBucketCount - 1)], &idEntry->bucketElt);
+
+        i32 x0 = bb_card_grid_coord(card->rect.x);
+        i32 x1 = bb_card_grid_coord(card->rect.x + card->rect.w);
+        i32 y0 = bb_card_grid_coord(card->rect.y);
+        i32 y1 = bb_card_grid_coord(card->rect.y + card->rect.h);
+
+        for(i32 y = y0; y <= y1; y++)
+        {
+            for(i32 x = x0; x <= x1; x++)
+            {
+                bb_card_grid_entry* entry = oc_arena_push_type(&grid->arena, bb_card_grid_entry);
+                entry->x = x;
+                entry->y = y;
+                entry->card = card;
+                oc_list_push_back(&grid->buckets[bb_card_grid_bucket_index(grid, x, y)], &entry->bucketElt);
+            }
+        }
+    }
+}
+
+oc_list bb_card_grid_bucket(bb_card_grid* grid, i32 x, i32 y)
+{
+    oc_list bucket = { 0 };
+    if(grid->buckets)
+    {
+        bucket = grid->buckets[bb_card_grid_bucket_index(grid, x, y)];
+    }
+    return (bucket);
+}
+
+bb_card* bb_card_grid_find_card(bb_card_grid* grid, u64 id)
+{
+    bb_card* result = 0;
+    if(grid->idBuckets)
+    {
+        oc_list_for(grid->idBuckets[id & (grid->idBucketCount - 1)], entry, bb_card_grid_entry, bucketElt)
+        {
+            if(entry->card->id == id)
+            {
+                result = entry->card;
+                break;
+            }
+        }
+    }
+    return (result);
+}
+
+oc_vec2 bb_whisker_tip(oc_rect rect, u32 dirIndex)
+{
+    oc_vec2 center = {
+        rect.x + rect.w / 2,
+        rect.y + rect.h / 2,
+    };
+    oc_vec2 tip = center;
+    switch(dirIndex)
+    {
+        case BB_WHISKER_DIRECTION_UP:
+            tip.y = rect.y - BB_WHISKER_SIZE;
+            break;
+        case BB_WHISKER_DIRECTION_LEFT:
+            tip.x = rect.x - BB_WHISKER_SIZE;
+            break;
+        case BB_WHISKER_DIRECTION_DOWN:
+            tip.y = rect.y + rect.h + BB_WHISKER_SIZE;
+            break;
+        case BB_WHISKER_DIRECTION_RIGHT:
+            tip.x = rect.x + rect.w + BB_WHISKER_SIZE;
+            break;
+    }
+    return (tip);
+}
+
+const bb_atom bb_direction_atoms[] = {
+    BB_ATOM_UP,
+    BB_ATOM_LEFT,
+    BB_ATOM_DOWN,
+    BB_ATOM_RIGHT,
+};
+
+void bb_builtin_responder_point_from(bb_worker* worker, bb_card* pointer, bb_value* dir, bb_value* q)
+{
+    bb_facts_db* factDb = worker->factDb;
+
+    for(u32 dirIndex = 0; dirIndex < BB_WHISKER_DIRECTION_COUNT; dirIndex++)
+    {
+        if(dir->kind == BB_VALUE_PLACEHOLDER
+           || (dir->kind == BB_VALUE_SYMBOL && dir->atom == bb_direction_atoms[dirIndex]))
+        {
+            bb_worker_set_frame(worker, &pointer->whiskerFrame[dirIndex]);
+
+            //NOTE: the whisker points at the cards whose rect contains its tip
+            oc_vec2 tip = bb_whisker_tip(pointer->rect, dirIndex);
+            i32 cellX = bb_card_grid_coord(tip.x);
+            i32 cellY = bb_card_grid_coord(tip.y);
+            oc_list bucket = bb_card_grid_bucket(&factDb->cardGrid, cellX, cellY);
+
+            oc_list_for(bucket, entry, bb_card_grid_entry, bucketElt)
+            {
+                bb_card* pointee = entry->card;
+                if(entry->x == cellX
+                   && entry->y == cellY
+                   && (q->kind == BB_VALUE_PLACEHOLDER || (q->kind == BB_VALUE_CARD_ID && q->valU64 == pointee->id)))
+                {
+                    oc_rect qRect = pointee->rect;
+                    bool test = tip.x >= qRect.x
+                             && tip.x <= (qRect.x + qRect.w)
+                             && tip.y >= qRect.y
+                             && tip.y <= (qRect.y + qRect.h);
+
+                    if(test)
+                    {
+                        bb_worker_set_frame(worker, &pointer->whiskerBoldFrame[dirIndex]);
+
+                        //NOTE add a fact to the database, which will be picked up next iteration...
+                        bb_value fact[] = {
+                            { .kind = BB_VALUE_LIST, .size = 6, .count = 5 },
+                            { .kind = BB_VALUE_CARD_ID, .size = 1, .valU64 = pointer->id },
+                            { .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_POINTS },
+                            { .kind = BB_VALUE_SYMBOL, .size = 1, .atom = bb_direction_atoms[dirIndex] },
+                            { .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_AT },
+                            { .kind = BB_VALUE_CARD_ID, .size = 1, .valU64 = pointee->id },
+                        };
+
+                        //NOTE: the answer only depends on the rects of the pointer and the pointee. Other cards
+                        //      moving in or out of the whisker's tip produce or retract other answers.
+                        bb_dependency deps[2] = {
+                            { .card = pointer, .inputs = BB_INPUT_RECTS },
+                            { .card = pointee, .inputs = BB_INPUT_RECTS },
+                        };
+                        bb_provenance provenance = { .count = 2, .deps = deps };
+                        bb_worker_claim(worker, fact, 0, provenance);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bb_fact* bb_builtin_responder_point(bb_worker* worker, bb_value* query, bb_value** slots)
+{
+    bb_facts_db* factDb = worker->factDb;
+
+    bb_value* p = slots[BB_BUILTIN_SLOT_P];
+    bb_value* dir = slots[BB_BUILTIN_SLOT_DIR];
+    bb_value* q = slots[BB_BUILTIN_SLOT_Q];
+
+    if(p->kind == BB_VALUE_PLACEHOLDER)
+    {
+        oc_list_for(factDb->cards, pointer, bb_card, listElt)
+        {
+            bb_builtin_responder_point_from(worker, pointer, dir, q);
+        }
+    }
+    else if(p->kind == BB_VALUE_CARD_ID)
+    {
+        bb_card* pointer = bb_card_grid_find_card(&factDb->cardGrid, p->valU64);
+        if(pointer)
+        {
+            bb_builtin_responder_point_from(worker, pointer, dir, q);
+        }
+    }
+    return 0;
+}
+
+bb_fact* bb_builtin_responder_clicked(bb_worker* worker, bb_value* query, bb_value** slots)
+{
+    bb_facts_db* factDb = worker->factDb;
+
+    bb_value* p = slots[BB_BUILTIN_SLOT_P];
+
+    oc_list_for(factDb->cards, card, bb_card, listElt)
+    {
+        if(p->kind == BB_VALUE_PLACEHOLDER || (p->kind == BB_VALUE_CARD_ID && p->valU64 == card->id))
+        {
+            if(card->clickedFrame == factDb->frame)
+            {
+                bb_value fact[] = {
+                    { .kind = BB_VALUE_LIST, .size = 4, .count = 3 },
+                    { .kind = BB_VALUE_CARD_ID, .size = 1, .valU64 = card->id },
+                    { .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_IS },
+                    { .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_CLICKED },
+                };
+
+                bb_dependency dep = { .card = card, .inputs = BB_INPUT_CLICKS };
+                bb_provenance provenance = { .count = 1, .deps = &dep };
+                bb_worker_claim(worker, fact, 0, provenance);
+            }
+        }
+    }
+    return 0;
+}
+
+void bb_program_init_builtin_responders(oc_arena* arena, bb_facts_db* factDb)
+{
+    {
+        bb_responder* responder = oc_arena_push_type(arena, bb_responder);
+
+        bb_value* pattern = oc_arena_push_array(arena, bb_value, 6);
+        pattern[0] = (bb_value){ .kind = BB_VALUE_LIST, .size = 6, .count = 5 };
+        pattern[1] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_P, .slot = BB_BUILTIN_SLOT_P };
+        pattern[2] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_POINTS };
+        pattern[3] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_DIR, .slot = BB_BUILTIN_SLOT_DIR };
+        pattern[4] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_AT };
+        pattern[5] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_Q, .slot = BB_BUILTIN_SLOT_Q };
+
+        responder->pattern = pattern;
+        responder->proc = bb_builtin_responder_point;
+        responder->inputs = BB_INPUT_RECTS;
+        oc_arena_init(&responder->memoArena);
+        responder->memoBuckets = 0;
+
+        oc_list_push_back(&factDb->responders, &responder->listElt);
+    }
+
+    {
+        bb_responder* responder = oc_arena_push_type(arena, bb_responder);
+
+        bb_value* pattern = oc_arena_push_array(arena, bb_value, 4);
+        pattern[0] = (bb_value){ .kind = BB_VALUE_LIST, .size = 4, .count = 3 };
+        pattern[1] = (bb_value){ .kind = BB_VALUE_PLACEHOLDER, .size = 1, .atom = BB_ATOM_P, .slot = BB_BUILTIN_SLOT_P };
+        pattern[2] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_IS };
+        pattern[3] = (bb_value){ .kind = BB_VALUE_SYMBOL, .size = 1, .atom = BB_ATOM_CLICKED };
+
+        responder->pattern = pattern;
+        responder->proc = bb_builtin_responder_clicked;
+        responder->inputs = BB_INPUT_CLICKS;
+        oc_arena_init(&responder->memoArena);
+        responder->memoBuckets = 0;
+
+        oc_list_push_back(&factDb->responders, &responder->listElt);
+    }
+}
+
+bool bb_cell_contains_set(bb_cell* cell)
+{
+    if(cell->kind == BB_CELL_KEYWORD && cell->valU64 == BB_TOKEN_KW_SET)
+    {
+        return (true);
+    }
+    oc_list_for(cell->children, child, bb_cell, parentElt)
+    {
+        if(bb_cell_contains_set(child))
+        {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+void bb_program_carry_over_display(bb_facts_db* factDb, oc_list cards)
+{
+    //NOTE: nothing changed since last frame, so the effects of listeners and responders still hold
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        oc_list_for(factDb->listeners, listener, bb_listener, listElt)
+        {
+            listener->carry(factDb, card);
+        }
+        for(u32 i = 0; i < BB_WHISKER_DIRECTION_COUNT; i++)
+        {
+            if(card->whiskerFrame[i] == factDb->frame - 1)
+            {
+                card->whiskerFrame[i] = factDb->frame;
+            }
+            if(card->whiskerBoldFrame[i] == factDb->frame - 1)
+            {
+                card->whiskerBoldFrame[i] = factDb->frame;
+            }
+        }
+    }
+}
+
+typedef struct bb_program_pass
+{
+    u32 itCount;
+    u64 frameIteration;
+
+    //NOTE: parallel passes only. Cards are handed out to workers in order, and each card's claims are
+    //      buffered in its own list, so that they can be merged in card order.
+    u32 cardCount;
+    bb_card** cards;
+    oc_list* claims;
+    u32 nextCard;
+
+} bb_program_pass;
+
+void bb_program_eval_card(bb_worker* worker, bb_program_pass* pass, bb_card* card)
+{
+    bb_facts_db* factDb = worker->factDb;
+
+    //NOTE: in the first pass, cards that are not re-evaluated only join against the facts produced
+    //      this frame. Subsequent passes only join top-level cells against the facts produced since
+    //      they last ran, unless the card changed one of its variables.
+    bool fullPass = false;
+    if(pass->itCount == 0)
+    {
+        fullPass = card->rerun;
+        if(fullPass)
+        {
+            worker->cardsEvaluated++;
+        }
+    }
+    else
+    {
+        fullPass = card->varsChanged;
+    }
+    card->varsChanged = false;
+
+    //NOTE: slots and the values of the card's own variables live until the end of the card
+    oc_arena_scope scope = oc_arena_scope_begin(&worker->scratchArena);
+    bb_value** slots = oc_arena_push_array(&worker->scratchArena, bb_value*, card->code->slotCount);
+    memset(slots, 0, card->code->slotCount * sizeof(bb_value*));
+
+    bb_dependency dep = { .card = card, .inputs = BB_INPUT_CODE };
+    bb_provenance provenance = { .count = 1, .deps = &dep };
+
+    f64 startTime = factDb->profiling ? oc_clock_time(OC_CLOCK_MONOTONIC) : 0;
+    u64 scannedBefore = worker->factsScanned;
+    u64 claimedBefore = worker->factsClaimed;
+    u64 matchCount = 0;
+
+    oc_list_for(card->code->statements, stmt, bb_stmt, listElt)
+    {
+        u64 deltaIteration = 0;
+        if(!fullPass)
+        {
+            deltaIteration = (pass->itCount == 0) ? pass->frameIteration : stmt->cell->lastRun;
+        }
+        stmt->cell->lastRun = factDb->iteration;
+
+        u64 matchesBefore = stmt->profile.total.matches;
+        bb_program_exec_stmt(worker, card, stmt, slots, provenance, deltaIteration);
+        matchCount += stmt->profile.total.matches - matchesBefore;
+    }
+    oc_arena_scope_end(scope);
+
+    if(factDb->profiling)
+    {
+        bb_profile_counters counters = {
+            .evaluations = 1,
+            .factsScanned = worker->factsScanned - scannedBefore,
+            .matches = matchCount,
+            .factsProduced = worker->factsClaimed - claimedBefore,
+            .nanoseconds = (oc_clock_time(OC_CLOCK_MONOTONIC) - startTime) * 1e9,
+        };
+        bb_profile_add(&card->profile, factDb->frame, &counters);
+    }
+}
+
+void bb_worker_run_pass(bb_worker* worker, bb_program_pass* pass)
+{
+    bb_facts_db* factDb = worker->factDb;
+
+    //NOTE: cards are handed out a few at a time, so that workers don't contend on the mutex when cards are cheap
+    u32 batchSize = oc_max(1, pass->cardCount / (8 * factDb->workerCount));
+
+    worker->deferred = true;
+    while(true)
+    {
+        oc_mutex_lock(factDb->workerMutex);
+        u32 first = pass->nextCard;
+        u32 end = oc_min(first + batchSize, pass->cardCount);
+        pass->nextCard = end;
+        oc_mutex_unlock(factDb->workerMutex);
+
+        if(first == end)
+        {
+            break;
+        }
+        for(u32 cardIndex = first; cardIndex < end; cardIndex++)
+        {
+            worker->claims = &pass->claims[cardIndex];
+            bb_program_eval_card(worker, pass, pass->cards[cardIndex]);
+        }
+    }
+    worker->deferred = false;
+    worker->claims = 0;
+}
+
+i32 bb_worker_main(void* userPointer)
+{
+    //NOTE: workers wait for passes until the db is cleaned up
+    bb_worker* worker = (bb_worker*)userPointer;
+    bb_facts_db* factDb = worker->factDb;
+    u64 passIndex = 0;
+
+    oc_mutex_lock(factDb->workerMutex);
+    while(true)
+    {
+        while(factDb->passIndex == passIndex && !factDb->workersQuit)
+        {
+            oc_condition_wait(factDb->workerStart, factDb->workerMutex);
+        }
+        if(factDb->workersQuit)
+        {
+            break;
+        }
+        passIndex = factDb->passIndex;
+        bb_program_pass* pass = factDb->pass;
+        oc_mutex_unlock(factDb->workerMutex);
+
+        bb_worker_run_pass(worker, pass);
+
+        oc_mutex_lock(factDb->workerMutex);
+        factDb->workersPending--;
+        if(!factDb->workersPending)
+        {
+            oc_condition_signal(factDb->workerDone);
+        }
+    }
+    oc_mutex_unlock(factDb->workerMutex);
+    return (0);
+}
+
+void bb_program_init_workers(bb_facts_db* factDb)
+{
+    if(!factDb->workerCount)
+    {
+        long coreCount = sysconf(_SC_NPROCESSORS_ONLN);
+        factDb->workerCount = (coreCount > 0) ? coreCount : 1;
+    }
+    factDb->workerCount = oc_min(factDb->workerCount, BB_MAX_WORKER_COUNT);
+
+    factDb->workers = oc_arena_push_array(&factDb->persistentArena, bb_worker, factDb->workerCount);
+    memset(factDb->workers, 0, factDb->workerCount * sizeof(bb_worker));
+
+    if(factDb->workerCount > 1)
+    {
+        factDb->workerMutex = oc_mutex_create();
+        factDb->workerStart = oc_condition_create();
+        factDb->workerDone = oc_condition_create();
+        factDb->responderMutex = oc_mutex_create();
+    }
+
+    for(u32 i = 0; i < factDb->workerCount; i++)
+    {
+        bb_worker* worker = &factDb->workers[i];
+        worker->factDb = factDb;
+        oc_arena_init(&worker->scratchArena);
+        if(i != 0)
+        {
+            oc_arena_init(&worker->frameArena);
+            worker->arena = &worker->frameArena;
+            worker->thread = oc_thread_create(bb_worker_main, worker);
+        }
+    }
+}
+
+void bb_program_stop_workers(bb_facts_db* factDb)
+{
+    if(factDb->workerCount > 1)
+    {
+        oc_mutex_lock(factDb->workerMutex);
+        factDb->workersQuit = true;
+        oc_condition_broadcast(factDb->workerStart);
+        oc_mutex_unlock(factDb->workerMutex);
+
+        for(u32 i = 1; i < factDb->workerCount; i++)
+        {
+            oc_thread_join(factDb->workers[i].thread, 0);
+        }
+
+        oc_mutex_destroy(factDb->workerMutex);
+        oc_condition_destroy(factDb->workerStart);
+        oc_condition_destroy(factDb->workerDone);
+        oc_mutex_destroy(factDb->responderMutex);
+    }
+
+    for(u32 i = 0; i < factDb->workerCount; i++)
+    {
+        bb_worker* worker = &factDb->workers[i];
+        oc_arena_cleanup(&worker->scratchArena);
+        if(i != 0)
+        {
+            oc_arena_cleanup(&worker->frameArena);
+        }
+    }
+    factDb->workers = 0;
+}
+
+void bb_fact_db_cleanup(bb_facts_db* factDb)
+{
+    if(factDb->workers)
+    {
+        bb_program_stop_workers(factDb);
+    }
+
+    oc_list_for(factDb->responders, responder, bb_responder, listElt)
+    {
+        oc_arena_cleanup(&responder->memoArena);
+        responder->memoBuckets = 0;
+    }
+
+    if(factDb->buckets)
+    {
+        //NOTE: the code of active cards and the listeners point into the alpha memory pool, so they're released
+        //      before the pools. Cards must be recompiled if they're used with another db.
+        for(u32 i = 0; i < factDb->activeCount; i++)
+        {
+            bb_card* card = factDb->activeCards[i];
+            if(card->code)
+            {
+                bb_card_release_code(factDb, card);
+                oc_arena_cleanup(&card->codeArena);
+                card->code = 0;
+            }
+        }
+        factDb->activeCount = 0;
+
+        oc_list_for(factDb->listeners, listener, bb_listener, listElt)
+        {
+            if(listener->memory)
+            {
+                bb_alpha_memory_release(factDb, listener->memory);
+                listener->memory = 0;
+            }
+        }
+
+        //NOTE: facts are removed first, so that they release their atoms and the tuples that don't fit in pools
+        oc_list_for_safe(factDb->facts, fact, bb_fact, listElt)
+        {
+            bb_fact_db_remove(factDb, fact);
+        }
+
+        oc_pool_release(&factDb->factPool);
+        for(u32 i = 0; i < BB_TUPLE_CLASS_COUNT; i++)
+        {
+            oc_pool_release(&factDb->tuplePools[i]);
+        }
+        oc_pool_release(&factDb->alphaMemoryPool);
+        oc_pool_release(&factDb->argIndexPool);
+        oc_pool_release(&factDb->factEntryPool);
+        oc_pool_release(&factDb->supportPool);
+        for(u32 i = 0; i < BB_STRING_CLASS_COUNT; i++)
+        {
+            oc_pool_release(&factDb->strings.pools[i]);
+        }
+        factDb->buckets = 0;
+    }
+
+    if(factDb->cardGrid.buckets)
+    {
+        oc_arena_cleanup(&factDb->cardGrid.arena);
+        factDb->cardGrid.buckets = 0;
+    }
+
+    oc_arena_cleanup(&factDb->persistentArena);
+}
+
+void bb_program_run_parallel_pass(oc_arena* frameArena, bb_facts_db* factDb, bb_program_pass* pass)
+{
+    //NOTE: cards only read the db during the pass, and their claims are buffered by the workers
+    pass->cardCount = factDb->activeCount;
+    pass->cards = factDb->activeCards;
+    pass->claims = oc_arena_push_array(frameArena, oc_list, pass->cardCount);
+    memset(pass->claims, 0, pass->cardCount * sizeof(oc_list));
+
+    oc_mutex_lock(factDb->workerMutex);
+    factDb->pass = pass;
+    factDb->passIndex++;
+    factDb->workersPending = factDb->workerCount - 1;
+    oc_condition_broadcast(factDb->workerStart);
+    oc_mutex_unlock(factDb->workerMutex);
+
+    bb_worker_run_pass(&factDb->workers[0], pass);
+
+    oc_mutex_lock(factDb->workerMutex);
+    while(factDb->workersPending)
+    {
+        oc_condition_wait(factDb->workerDone, factDb->workerMutex);
+    }
+    oc_mutex_unlock(factDb->workerMutex);
+
+    //NOTE: merge claims in card order, so that the db doesn't depend on how cards were scheduled. Merged
+    //      facts are newer than all statements that ran during the pass, so they're joined in the next one.
+    factDb->iteration++;
+    for(u32 cardIndex = 0; cardIndex < pass->cardCount; cardIndex++)
+    {
+        oc_list_for(pass->claims[cardIndex], claim, bb_claim, listElt)
+        {
+            bb_fact_db_push(factDb, claim->root, claim->claimer, claim->provenance);
+        }
+    }
+}
+
+void bb_program_retain_variable_atoms(oc_list cards)
+{
+    //NOTE: set statements store values in variables from the workers, so variables take a reference to the
+    //      atom of their value once the update is over
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        oc_list_for(card->variables, variable, bb_bound_val, cardElt)
+        {
+            bb_atom atom = bb_value_has_atom(variable->value) ? variable->value->atom : BB_ATOM_NIL;
+            if(atom != variable->valueAtom)
+            {
+                if(atom != BB_ATOM_NIL)
+                {
+                    bb_atom_retain(atom);
+                }
+                if(variable->valueAtom != BB_ATOM_NIL)
+                {
+                    bb_atom_release(variable->valueAtom);
+                }
+                variable->valueAtom = atom;
+            }
+        }
+    }
+}
+
+bb_program_stats bb_program_update(oc_arena* frameArena, bb_facts_db* factDb, oc_list cards)
+{
+    f64 start = oc_clock_time(OC_CLOCK_MONOTONIC);
+
+    if(!factDb->buckets)
+    {
+        bb_fact_db_clear(factDb);
+        factDb->iteration = 1;
+    }
+    if(!factDb->workers)
+    {
+        bb_program_init_workers(factDb);
+    }
+    for(u32 i = 0; i < factDb->workerCount; i++)
+    {
+        bb_worker* worker = &factDb->workers[i];
+        if(i == 0)
+        {
+            worker->arena = frameArena;
+        }
+        else
+        {
+            oc_arena_clear(worker->arena);
+        }
+        worker->factsScanned = 0;
+        worker->factsSkipped = 0;
+        worker->factsClaimed = 0;
+        worker->cardsEvaluated = 0;
+    }
+    factDb->factsRetracted = 0;
+    factDb->cards = cards;
+
+    //NOTE: collect the inputs of each card that changed since the last update. Facts that depend on the code of
+    //      edited or stateful cards, on the rects of moved cards, or on the clicks of clicked cards are retracted,
+    //      as well as all facts that depend on removed cards. Stateful cards (ie. cards that set variables) are
+    //      re-evaluated every frame.
+    u32 dirtyInputs = 0;
+    bool rerun = false;
+    bool cardsChanged = false;
+
+    u32 activeCount = 0;
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        bool added = (card->activeFrame != factDb->frame - 1);
+        bool edited = (card->root->lastEdit == factDb->frame);
+        cardsChanged |= added;
+
+        if(added || edited || !card->code)
+        {
+            card->stateful = bb_cell_contains_set(card->root);
+            bb_card_compile(factDb, card);
+        }
+
+        card->dirtyInputs = 0;
+        if(edited || card->stateful)
+        {
+            card->dirtyInputs |= BB_INPUT_CODE;
+        }
+        if(added
+           || card->rect.x != card->evalRect.x
+           || card->rect.y != card->evalRect.y
+           || card->rect.w != card->evalRect.w
+           || card->rect.h != card->evalRect.h)
+        {
+            card->dirtyInputs |= BB_INPUT_RECTS;
+        }
+        if(card->clickedFrame == factDb->frame || card->clickedFrame + 1 == factDb->frame)
+        {
+            card->dirtyInputs |= BB_INPUT_CLICKS;
+        }
+        dirtyInputs |= card->dirtyInputs;
+
+        card->rerun = added || edited || card->stateful;
+        rerun |= card->rerun;
+
+        card->activeFrame = factDb->frame;
+        card->evalRect = card->rect;
+        activeCount++;
+    }
+
+    for(u32 i = 0; i < factDb->activeCount; i++)
+    {
+        bb_card* card = factDb->activeCards[i];
+        if(card->activeFrame != factDb->frame)
+        {
+            //NOTE: card was removed from the active list. Its code is recompiled if it comes back.
+            bb_card_release_code(factDb, card);
+            card->dirtyInputs = BB_INPUT_CODE | BB_INPUT_RECTS | BB_INPUT_CLICKS;
+            dirtyInputs |= card->dirtyInputs;
+            cardsChanged = true;
+        }
+    }
+
+    if(factDb->incremental)
+    {
+        //NOTE: retract facts that depend on changed inputs. Since provenance is transitive, this also retracts
+        //      everything that was derived from them. Cards that claimed a retracted fact are re-evaluated, to
+        //      re-derive facts that are still valid. A fact has a single support per card, so retracting it
+        //      only removes the current support from the card's list.
+        for(u32 i = 0; i < factDb->activeCount; i++)
+        {
+            bb_card* card = factDb->activeCards[i];
+            if(card->activeFrame != factDb->frame)
+            {
+                oc_list_for_safe(card->supports, support, bb_support, cardElt)
+                {
+                    bb_fact_db_retract(factDb, support->fact);
+                }
+            }
+        }
+        oc_list_for(cards, card, bb_card, listElt)
+        {
+            if(card->dirtyInputs)
+            {
+                oc_list_for_safe(card->supports, support, bb_support, cardElt)
+                {
+                    if(support->inputs & card->dirtyInputs)
+                    {
+                        bb_fact_db_retract(factDb, support->fact);
+                    }
+                }
+            }
+        }
+    }
+
+    if(activeCount > factDb->activeCapacity)
+    {
+        factDb->activeCapacity = oc_max(activeCount, 2 * factDb->activeCapacity);
+        factDb->activeCards = oc_arena_push_array(&factDb->persistentArena, bb_card*, factDb->activeCapacity);
+    }
+    factDb->activeCount = 0;
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        factDb->activeCards[factDb->activeCount] = card;
+        factDb->activeCount++;
+    }
+
+    if((dirtyInputs & BB_INPUT_RECTS) || !factDb->cardGrid.buckets)
+    {
+        bb_card_grid_build(&factDb->cardGrid, cards);
+    }
+
+    //NOTE: memoized answers of responders are dropped when their inputs change. All responders look up
+    //      cards, so they're all dropped when the set of active cards changes.
+    oc_list_for(factDb->responders, responder, bb_responder, listElt)
+    {
+        if(cardsChanged || (responder->inputs & dirtyInputs))
+        {
+            bb_responder_clear_memo(responder);
+        }
+    }
+
+    u32 itCount = 0;
+
+    if(!factDb->incremental)
+    {
+        bb_fact_db_clear(factDb);
+        oc_list_for(cards, card, bb_card, listElt)
+        {
+            card->rerun = true;
+        }
+    }
+    else if(!rerun && !dirtyInputs)
+    {
+        //NOTE: nothing changed, the db is already at a fixed point
+        bb_program_carry_over_display(factDb, cards);
+        factDb->frame++;
+
+        return ((bb_program_stats){
+            .frame = factDb->frame - 1,
+            .duration = oc_clock_time(OC_CLOCK_MONOTONIC) - start,
+        });
+    }
+
+    //NOTE: listeners only process facts that are new since they last ran, and the display state they set
+    //      last frame is carried over. If some of the facts they processed were retracted since, they start
+    //      over from all the facts of their memory.
+    oc_list_for(factDb->listeners, listener, bb_listener, listElt)
+    {
+        if(!listener->memory || listener->memory->removeCount != listener->removeCount)
+        {
+            listener->lastRun = 0;
+        }
+        else
+        {
+            oc_list_for(cards, card, bb_card, listElt)
+            {
+                listener->carry(factDb, card);
+            }
+        }
+    }
+
+    //NOTE: run until fixed point (i.e. until iteration doesn't generate any new facts)
+    u32 prevFactCount = 0;
+    u64 frameIteration = factDb->iteration;
+    bool varsChanged = false;
+    bool parallel = (factDb->workerCount > 1 && factDb->activeCount >= BB_PARALLEL_MIN_CARD_COUNT);
+
+    do
+    {
+        prevFactCount = factDb->factCount;
+
+        bb_program_pass pass = {
+            .itCount = itCount,
+            .frameIteration = frameIteration,
+        };
+        if(parallel)
+        {
+            bb_program_run_parallel_pass(frameArena, factDb, &pass);
+        }
+        else
+        {
+            oc_list_for(cards, card, bb_card, listElt)
+            {
+                bb_program_eval_card(&factDb->workers[0], &pass, card);
+            }
+        }
+
+        bb_program_run_builtin_listeners(&factDb->workers[0], cards);
+
+        varsChanged = false;
+        oc_list_for(cards, card, bb_card, listElt)
+        {
+            varsChanged |= card->varsChanged;
+        }
+
+        itCount++;
+    }
+    while(prevFactCount != factDb->factCount || varsChanged);
+
+    //NOTE: atoms released by this update are freed now that no pass is running. Memoized answers of
+    //      responders may hold freed atoms, whose ids can be reused, so they are dropped.
+    bb_program_retain_variable_atoms(cards);
+    if(bb_atom_collect())
+    {
+        oc_list_for(factDb->responders, responder, bb_responder, listElt)
+        {
+            bb_responder_clear_memo(responder);
+        }
+    }
+
+    f32 duration = oc_clock_time(OC_CLOCK_MONOTONIC) - start;
+
+    //    bb_debug_print_facts(factDb);
+    //printf("Fix point reached in %u iterations and %f seconds\n", itCount, duration);
+
+    factDb->frame++;
+
+    bb_program_stats stats = {
+        .frame = factDb->frame - 1,
+        .iterations = itCount,
+        .duration = duration,
+        .factsRetracted = factDb->factsRetracted,
+    };
+    for(u32 i = 0; i < factDb->workerCount; i++)
+    {
+        stats.factsScanned += factDb->workers[i].factsScanned;
+        stats.factsSkipped += factDb->workers[i].factsSkipped;
+        stats.cardsEvaluated += factDb->workers[i].cardsEvaluated;
+    }
+    return (stats);
+}
+
+//------------------------------------------------------------------------------------------------
+// Profiling
+//------------------------------------------------------------------------------------------------
+
+void bb_program_collect_stmt_profiles(bb_profile_list* list, bb_card* card, oc_list statements, u32 frame, bool total)
+{
+    oc_list_for(statements, stmt, bb_stmt, listElt)
+    {
+        if(stmt->kind == BB_STMT_WHEN)
+        {
+            if(total || stmt->profile.frame == frame)
+            {
+                if(list->entries)
+                {
+                    list->entries[list->count] = (bb_profile_entry){
+                        .card = card,
+                        .cell = stmt->cell,
+                        .profile = &stmt->profile,
+                    };
+                }
+                list->count++;
+            }
+            bb_program_collect_stmt_profiles(list, card, stmt->body, frame, total);
+        }
+    }
+}
+
+void bb_program_collect_card_profiles(bb_profile_list* list, oc_list cards, u32 frame, bool total)
+{
+    oc_list_for(cards, card, bb_card, listElt)
+    {
+        if(total || card->profile.frame == frame)
+        {
+            if(list->entries)
+            {
+                list->entries[list->count] = (bb_profile_entry){
+                    .card = card,
+                    .profile = &card->profile,
+                };
+            }
+            list->count++;
+        }
+        //NOTE: the code of cards edited since the last update refers to cells that may have been recycled
+        if(card->code && card->root->lastEdit <= frame)
+        {
+            bb_program_collect_stmt_profiles(list, card, card->code->statements, frame, total);
+        }
+    }
+}
+
+int bb_profile_entry_compare_last(const void* a, const void* b)
+{
+    u64 x = ((bb_profile_entry*)a)->profile->last.nanoseconds;
+    u64 y = ((bb_profile_entry*)b)->profile->last.nanoseconds;
+    return ((x < y) - (x > y));
+}
+
+int bb_profile_entry_compare_total(const void* a, const void* b)
+{
+    u64 x = ((bb_profile_entry*)a)->profile->total.nanoseconds;
+    u64 y = ((bb_profile_entry*)b)->profile->total.nanoseconds;
+    return ((x < y) - (x > y));
+}
+
+bb_profile_list bb_program_collect_profiles(oc_arena* arena, bb_facts_db* factDb, oc_list cards, bool total)
+{
+    //NOTE: collects the profiles of cards and of their whens, sorted by decreasing time. If total is false,
+    //      only the cards and whens evaluated by the last update are collected, sorted by the time spent in
+    //      that update. Otherwise, all of them are collected and sorted by the time spent since they were
+    //      compiled.
+    u32 frame = factDb->frame - 1;
+
+    bb_profile_list list = { 0 };
+    bb_program_collect_card_profiles(&list, cards, frame, total);
+
+    list.entries = oc_arena_push_array(arena, bb_profile_entry, list.count);
+    list.count = 0;
+    bb_program_collect_card_profiles(&list, cards, frame, total);
+
+    qsort(list.entries,
+          list.count,
+          sizeof(bb_profile_entry),
+          total ? bb_profile_entry_compare_total : bb_profile_entry_compare_last);
+
+    return (list);
+}
+
+oc_str8 bb_profile_entry_label(oc_arena* arena, bb_profile_entry* entry)
+{
+    oc_str8 str = { 0 };
+    if(!entry->cell)
+    {
+        str = oc_str8_pushf(arena, "card-%u", entry->card->id);
+    }
+    else
+    {
+        //NOTE: whens are labeled by their pattern, which is the cell following the when keyword
+        bb_cell* keyword = bb_cell_first_child(entry->cell);
+        bb_cell* pattern = keyword ? bb_cell_next_sibling(keyword) : 0;
+        oc_str8 patternStr = pattern ? bb_cell_to_str8(arena, pattern) : (oc_str8){ 0 };
+
+        str = oc_str8_pushf(arena, "card-%u (when %.*s ...)", entry->card->id, oc_str8_ip(patternStr));
+    }
+    return (str);
+}
@@ -0,0 +1,659 @@
+/*************************************************************************
+*
+*  HMNJam24
+*  Copyright 2024 Martin Fouilleul
+*
+**************************************************************************/
+#ifndef __BB_ENGINE_H_
+#define __BB_ENGINE_H_
+
+#include "orca.h"
+
+//NOTE: headless rule engine: cells, lexing, the facts db and card evaluation. It doesn't use the window, graphics
+//      or UI parts of orca, so that it can be built as a library and run without the app, see runner.c.
+
+//------------------------------------------------------------------------------------------------
+// Atoms
+//------------------------------------------------------------------------------------------------
+
+//NOTE: atoms are interned strings. Symbols, strings and placeholder names are represented by their atom
+//      id in values, so that comparing them is an integer compare. Atom 0 is the empty string. Atoms are
+//      refcounted, and interned when cards are compiled rather than when cells are edited, so that the table
+//      only holds the atoms of compiled programs and of the facts derived from them.
+typedef u32 bb_atom;
+
+#define BB_BUILTIN_ATOMS(X)         \
+    X(NIL, "")                      \
+    X(WISHES, "wishes")             \
+    X(IS, "is")                     \
+    X(LABELED, "labeled")           \
+    X(HIGHLIGHTED, "highlighted")   \
+    X(POINTS, "points")             \
+    X(AT, "at")                     \
+    X(CLICKED, "clicked")           \
+    X(UP, "up")                     \
+    X(LEFT, "left")                 \
+    X(DOWN, "down")                 \
+    X(RIGHT, "right")               \
+    X(P, "p")                       \
+    X(Q, "q")                       \
+    X(S, "s")                       \
+    X(DIR, "dir")
+
+enum
+{
+#define X(name, str) OC_CAT2(BB_ATOM_, name),
+    BB_BUILTIN_ATOMS(X)
+#undef X
+        BB_BUILTIN_ATOM_COUNT,
+};
+
+bb_atom bb_atom_acquire(oc_str8 string);
+void bb_atom_retain(bb_atom atom);
+void bb_atom_release(bb_atom atom);
+oc_str8 bb_atom_string(bb_atom atom);
+u32 bb_atom_live_count(void);
+
+//NOTE: frees the atoms that were released since the last collection, and returns how many were freed
+u32 bb_atom_collect(void);
+
+//------------------------------------------------------------------------------------------------
+// Cells and cards
+//------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+    BB_CELL_HOLE,
+    BB_CELL_KEYWORD,
+    BB_CELL_OPERATOR,
+    BB_CELL_SYMBOL,
+    BB_CELL_CHAR,
+    BB_CELL_STRING,
+    BB_CELL_INT,
+    BB_CELL_FLOAT,
+    BB_CELL_COMMENT,
+    BB_CELL_PLACEHOLDER,
+
+    BB_CELL_LIST,
+
+} bb_cell_kind;
+
+typedef struct bb_cell bb_cell;
+
+struct bb_cell
+{
+    oc_list_elt parentElt;
+    bb_cell* parent;
+    oc_list children;
+    u32 childCount;
+
+    u64 id;
+    bb_cell_kind kind;
+    oc_str8 text;
+    u64 valU64;
+    f64 valF64;
+
+    oc_rect rect;
+    f32 lastLineWidth;
+
+    //NOTE: layout of the cell relative to its parent, reused until the cell or one of its descendants is
+    //      edited. layoutChanged tells that rect must be updated from it.
+    oc_rect layoutRect;
+    bool layoutVertical;
+    bool layoutChanged;
+    u32 layoutFrame;
+
+    u32 lastEdit;
+    u32 lastFrame;
+    u64 lastRun;
+};
+
+typedef struct bb_card_code bb_card_code;
+
+//NOTE: profile counters of a card or of a when statement. The counters of a when include the work done by its
+//      body, ie. the whens nested in it.
+typedef struct bb_profile_counters
+{
+    u64 evaluations;   // times the card or the when pattern was evaluated
+    u64 factsScanned;  // facts tested against when patterns
+    u64 matches;       // facts that matched when patterns
+    u64 factsProduced; // facts claimed
+    u64 nanoseconds;   // time spent evaluating
+} bb_profile_counters;
+
+typedef struct bb_profile
+{
+    u32 frame;                 // last frame in which the card or the when was evaluated
+    bb_profile_counters last;  // counters of that frame
+    bb_profile_counters total; // counters since the card or the when was compiled
+} bb_profile;
+
+typedef struct bb_string bb_string;
+typedef struct bb_thumbnail bb_thumbnail;
+
+typedef struct bb_card
+{
+    oc_list_elt listElt;
+
+    u32 id;
+    oc_rect rect;
+    oc_rect displayRect;
+
+    bb_cell* root;
+
+    oc_str8 label;
+    bb_string* labelString; // reference to the label, if it was formatted at runtime
+    u32 labelFrame;
+
+    oc_color highlight;
+    u32 highlightFrame;
+
+    u32 whiskerFrame[4];
+    u32 whiskerBoldFrame[4];
+
+    //NOTE: display of the card when it is shown as a thumbnail, and last frame it was laid out in the left
+    //      panel, owned by the app
+    bb_thumbnail* thumbnail;
+    u64 panelFrame;
+
+    oc_list variables;
+
+    u64 clickedFrame;
+
+    //NOTE: state of the card when it was last evaluated, used to find changed inputs in incremental updates
+    oc_rect evalRect;
+    u32 activeFrame;
+    bool stateful;
+    bool varsChanged;
+
+    //NOTE: supports of the facts that depend on the card, see bb_support. dirtyInputs are the inputs of the card
+    //      that changed since the last update, and rerun is set if the card must be fully re-evaluated.
+    oc_list supports;
+    u32 dirtyInputs;
+    bool rerun;
+
+    //NOTE: compiled statements of the card, rebuilt when the card is edited
+    oc_arena codeArena;
+    bb_card_code* code;
+
+    //NOTE: profile of the card's evaluations, see bb_program_collect_profiles()
+    bb_profile profile;
+} bb_card;
+
+enum
+{
+    BB_WHISKER_DIRECTION_UP = 0,
+    BB_WHISKER_DIRECTION_LEFT,
+    BB_WHISKER_DIRECTION_DOWN,
+    BB_WHISKER_DIRECTION_RIGHT,
+    BB_WHISKER_DIRECTION_COUNT,
+};
+
+extern f32 BB_WHISKER_SIZE;
+
+#define bb_cell_first_child(parent) oc_list_first_entry(((parent)->children), bb_cell, parentElt)
+#define bb_cell_last_child(parent) oc_list_last_entry(((parent)->children), bb_cell, parentElt)
+#define bb_cell_next_sibling(cell) oc_list_next_entry((cell), bb_cell, parentElt)
+#define bb_cell_prev_sibling(cell) oc_list_prev_entry((cell), bb_cell, parentElt)
+
+bool bb_cell_has_children(bb_cell* cell);
+bool bb_cell_has_text(bb_cell* cell);
+void bb_cell_push(bb_cell* parent, bb_cell* cell);
+void bb_cell_insert(bb_cell* afterSibling, bb_cell* cell);
+void bb_cell_insert_before(bb_cell* beforeSibling, bb_cell* cell);
+oc_str8 bb_cell_to_str8(oc_arena* arena, bb_cell* cell);
+
+//------------------------------------------------------------------------------------
+// Lexing
+//------------------------------------------------------------------------------------
+
+#define BB_TOKEN_KEYWORDS(X) \
+    X(KW_WHEN, "when")       \
+    X(KW_CLAIM, "claim")     \
+    X(KW_WISH, "wish")       \
+    X(KW_SELF, "self")       \
+    X(KW_VAR, "var")         \
+    X(KW_SET, "set")
+
+#define BB_TOKEN_OPERATORS(X) \
+    X(OP_ADD, "+")            \
+    X(OP_SUB, "-")
+
+enum
+{
+
+#define X(tok, str) OC_CAT2(BB_TOKEN_, tok),
+    BB_TOKEN_KEYWORDS(X) //
+    BB_TOKEN_OPERATORS(X)
+#undef X
+};
+
+typedef u32 bb_token;
+
+typedef struct bb_lex_result
+{
+    bb_cell_kind kind;
+    u64 valU64;
+    f64 valF64;
+    oc_str8 string;
+} bb_lex_result;
+
+bb_lex_result bb_lex_next(oc_str8 string, u64 byteOffset, bb_cell_kind srcKind);
+
+//NOTE: reads the text of a card program into a root list cell allocated from arena. Returns 0 on syntax errors.
+bb_cell* bb_read_program(oc_arena* arena, oc_str8 text);
+
+//------------------------------------------------------------------------------------------------
+// Rule system
+//------------------------------------------------------------------------------------------------
+
+typedef enum
+{
+    BB_VALUE_SYMBOL,
+    BB_VALUE_STRING,
+    BB_VALUE_U64,
+    BB_VALUE_F64,
+    BB_VALUE_CARD_ID,
+
+    BB_VALUE_LIST,
+
+    BB_VALUE_PLACEHOLDER,
+
+} bb_value_kind;
+
+//NOTE: values are stored as contiguous tuples of 16 bytes tagged values. A list is a header holding the
+//      number of children, followed by its children in pre-order. Each value stores the size of its tuple,
+//      ie. the number of values it spans including itself, so that siblings can be reached by skipping
+//      over nested lists.
+typedef struct bb_value
+{
+    bb_value_kind kind;
+    u32 size;
+
+    union
+    {
+        struct
+        {
+            bb_atom atom;
+            u32 slot; // slot of a placeholder in the pattern of a listener or responder
+        };
+        u64 valU64;
+        f64 valF64;
+        u64 count; // number of children of a list
+    };
+
+} bb_value;
+
+#define bb_value_for(list, child) \
+    for(bb_value* child = (list) + 1; child < (list) + (list)->size; child += child->size)
+
+typedef enum
+{
+    BB_INPUT_RECTS = 1 << 0,
+    BB_INPUT_CLICKS = 1 << 1,
+    BB_INPUT_CODE = 1 << 2, // program and variables of the card
+} bb_input_flags;
+
+//NOTE: the provenance of a claim is the set of cards and inputs it was (transitively) derived from. It holds at
+//      most one dependency per card.
+typedef struct bb_dependency
+{
+    bb_card* card;
+    u32 inputs;
+} bb_dependency;
+
+typedef struct bb_provenance
+{
+    u32 count;
+    bb_dependency* deps;
+} bb_provenance;
+
+typedef struct bb_fact
+{
+    oc_list_elt listElt;
+    oc_list_elt bucketElt;
+    u64 hash;
+    bb_value* root;
+    u64 iteration;
+
+    //NOTE: supports of the fact by the cards it was derived from, accumulated over all its derivations
+    u32 supportCount;
+    oc_list supports;
+
+    //NOTE: entries of the fact in alpha memories and argument indexes
+    oc_list alphaEntries;
+    oc_list argEntries;
+} bb_fact;
+
+//NOTE: support of a fact by a card, listed by both the fact and the card, so that the facts depending on a
+//      changed card are found without scanning the db. inputs are the inputs of the card the fact depends on,
+//      and claimer is set if the card claimed the fact, in which case it's re-evaluated when the fact is retracted.
+typedef struct bb_support
+{
+    oc_list_elt factElt;
+    oc_list_elt cardElt;
+    bb_fact* fact;
+    bb_card* card;
+    u32 inputs;
+    bool claimer;
+} bb_support;
+
+//NOTE: list of facts in insertion order, used by alpha memories and argument indexes
+typedef struct bb_fact_list
+{
+    u32 count;
+    oc_list entries;
+} bb_fact_list;
+
+typedef struct bb_fact_entry
+{
+    oc_list_elt listElt;
+    oc_list_elt factElt;
+    bb_fact* fact;
+    bb_fact_list* list;
+} bb_fact_entry;
+
+typedef struct bb_alpha_memory
+{
+    oc_list_elt bucketElt;
+    u64 key;
+    bb_value* pattern;
+    u32 refCount;
+    bb_fact_list facts;
+
+    //NOTE: number of facts ever removed from the memory, so that users can tell if facts they already
+    //      processed were retracted
+    u64 removeCount;
+} bb_alpha_memory;
+
+//NOTE: argument index of facts with a given arity and a given value at a given position
+typedef struct bb_arg_index
+{
+    oc_list_elt bucketElt;
+    u64 key;
+    bb_fact_list facts;
+} bb_arg_index;
+
+typedef struct bb_facts_db bb_facts_db;
+typedef struct bb_worker bb_worker;
+
+typedef struct bb_bound_val
+{
+    oc_list_elt cardElt;
+    bb_atom name;
+    bb_value* value;
+
+    bb_value storedValue;
+    bb_atom valueAtom; // atom of the value the variable holds a reference to
+} bb_bound_val;
+
+//NOTE: the placeholders of listener and responder patterns are resolved to slots when the patterns are built.
+//      Matching a pattern stores the value bound to each placeholder in an array of slots.
+enum
+{
+    BB_BUILTIN_SLOT_P = 0,
+    BB_BUILTIN_SLOT_Q,
+    BB_BUILTIN_SLOT_S,
+    BB_BUILTIN_SLOT_DIR,
+    BB_BUILTIN_SLOT_COUNT,
+};
+
+typedef void (*bb_listener_proc)(bb_value* match, bb_value** slots, bb_facts_db* factDb, oc_list cards);
+typedef void (*bb_listener_carry_proc)(bb_facts_db* factDb, bb_card* card);
+
+typedef struct bb_listener
+{
+    oc_list_elt listElt;
+    bb_value* pattern;
+    bb_listener_proc proc;
+
+    //NOTE: carries the display state set by the listener over to the next frame
+    bb_listener_carry_proc carry;
+
+    //NOTE: the listener only processes facts produced after lastRun. removeCount is the remove count of its
+    //      memory at that point.
+    u64 lastRun;
+    u64 removeCount;
+    bb_alpha_memory* memory;
+
+} bb_listener;
+
+typedef bb_fact* (*bb_responder_proc)(bb_worker* worker, bb_value* query, bb_value** slots);
+
+typedef struct bb_memo_entry bb_memo_entry;
+
+enum
+{
+    BB_RESPONDER_MEMO_BUCKET_COUNT = 256,
+};
+
+typedef struct bb_responder
+{
+    oc_list_elt listElt;
+    bb_value* pattern;
+    bb_responder_proc proc;
+
+    //NOTE: answers are memoized by query, until one of the inputs the responder reads changes.
+    //      See bb_program_run_responder().
+    u32 inputs;
+    oc_arena memoArena;
+    oc_list* memoBuckets;
+
+} bb_responder;
+
+enum
+{
+    //NOTE: fact tuples are allocated from pools of 4, 8, ..., 512 values
+    BB_TUPLE_MIN_SIZE = 4,
+    BB_TUPLE_CLASS_COUNT = 8,
+};
+
+//NOTE: strings formatted at runtime, eg. labels showing numbers, are stored in a refcounted store. Equal strings
+//      are shared, and their memory is recycled when their last reference is released, so the store is bounded
+//      by the strings that are alive. Strings of the program itself are atoms.
+typedef struct bb_string
+{
+    oc_list_elt bucketElt;
+    u64 hash;
+    u32 refCount;
+    oc_str8 string;
+} bb_string;
+
+enum
+{
+    //NOTE: strings are allocated along with their header from pools of 64, 128, ..., 2048 bytes
+    BB_STRING_MIN_SIZE = 64,
+    BB_STRING_CLASS_COUNT = 6,
+    BB_STRING_BUCKET_COUNT = 256,
+};
+
+typedef struct bb_string_store
+{
+    oc_pool pools[BB_STRING_CLASS_COUNT];
+    oc_list buckets[BB_STRING_BUCKET_COUNT];
+
+    u32 count;
+    u64 bytes; // size of the live strings and their headers
+} bb_string_store;
+
+enum
+{
+    BB_MAX_WORKER_COUNT = 16,
+
+    //NOTE: below this many cards, waking up the workers costs more than evaluating the cards sequentially
+    BB_PARALLEL_MIN_CARD_COUNT = 32,
+};
+
+typedef struct bb_program_pass bb_program_pass;
+
+enum
+{
+    BB_CARD_GRID_CELL_SIZE = 256,
+};
+
+typedef struct bb_card_grid_entry
+{
+    oc_list_elt bucketElt;
+    i32 x;
+    i32 y;
+    bb_card* card;
+} bb_card_grid_entry;
+
+typedef struct bb_card_grid
+{
+    oc_arena arena;
+    u32 bucketCount;
+    oc_list* buckets;
+
+    //NOTE: cards by id, so that queries about a given card don't scan the card list
+    u32 idBucketCount;
+    oc_list* idBuckets;
+} bb_card_grid;
+
+typedef struct bb_worker
+{
+    bb_facts_db* factDb;
+    oc_thread* thread;
+
+    //NOTE: claims deferred during a parallel pass are allocated from the worker's arena. The main worker uses
+    //      the frame arena, the others use their own and clear it each frame.
+    oc_arena* arena;
+    oc_arena frameArena;
+
+    //NOTE: values, bindings and matches produced while evaluating cards only live until the end of the card
+    //      or the statement that produced them, so they're allocated from scopes of the scratch arena. It stops
+    //      growing once it is large enough for the deepest evaluation, and is never cleared.
+    oc_arena scratchArena;
+
+    //NOTE: during a parallel pass, claims are deferred to the claim list of the card being evaluated
+    bool deferred;
+    oc_list* claims;
+
+    //NOTE: memo entry of the responder being run, which records its claims and display changes
+    bb_responder* memoResponder;
+    bb_memo_entry* memoEntry;
+
+    u64 factsScanned;
+    u64 factsSkipped;
+    u64 factsClaimed;
+    u64 cardsEvaluated;
+
+} bb_worker;
+
+typedef struct bb_facts_db
+{
+    oc_arena persistentArena;
+
+    //NOTE: facts persist across frames, so they and their values are allocated from pools and recycled
+    //      when retracted.
+    oc_pool factPool;
+    oc_pool tuplePools[BB_TUPLE_CLASS_COUNT];
+
+    u32 factCount;
+    oc_list facts;
+
+    //NOTE: structural hash set of facts, used to check if a fact already exists without scanning the facts list
+    u32 bucketCount;
+    oc_list* buckets;
+
+    //NOTE: alpha memories of when and listener patterns, see bb_alpha_memory_acquire()
+    oc_pool alphaMemoryPool;
+    oc_list* alphaBuckets;
+
+    //NOTE: argument indexes, keyed by arity, position and value, see bb_fact_db_index_fact()
+    oc_pool argIndexPool;
+    u32 argIndexCount;
+    u32 argBucketCount;
+    oc_list* argBuckets;
+
+    oc_pool factEntryPool;
+    oc_pool supportPool;
+
+    bb_string_store strings;
+
+    oc_list cards;
+    oc_list listeners;
+    oc_list responders;
+
+    u32 frame;
+    u64 iteration;
+
+    //NOTE: when incremental is set, only the consequences of changed inputs are retracted and re-derived
+    //      each frame. Otherwise the db is rebuilt from scratch. activeCards are the cards that were active
+    //      during the last update.
+    bool incremental;
+    u32 activeCount;
+    u32 activeCapacity;
+    bb_card** activeCards;
+
+    u64 factsRetracted;
+
+    //NOTE: cards are evaluated by a pool of workers, see bb_program_run_parallel_pass(). Worker 0 is the
+    //      thread calling bb_program_update(), the others are started on the first update. The pass fields
+    //      are protected by workerMutex. If workerCount is 0 on the first update, it's set to the number of
+    //      cores. A workerCount of 1 evaluates cards sequentially.
+    u32 workerCount;
+    bb_worker* workers;
+
+    oc_mutex* workerMutex;
+    oc_condition* workerStart;
+    oc_condition* workerDone;
+    bb_program_pass* pass;
+    u64 passIndex;
+    u32 workersPending;
+    bool workersQuit;
+
+    //NOTE: responders write display state on all cards, so they run under a lock during parallel passes
+    oc_mutex* responderMutex;
+
+    //NOTE: uniform grid over the rects of active cards, rebuilt when cards move. See bb_card_grid_build().
+    bb_card_grid cardGrid;
+
+    //NOTE: when profiling is set, cards and their whens record profile counters, see bb_program_collect_profiles()
+    bool profiling;
+
+} bb_facts_db;
+
+typedef struct bb_program_stats
+{
+    u64 frame;
+    u64 iterations;
+    f64 duration;
+
+    u64 factsScanned;   // facts matched against when and listener patterns
+    u64 factsSkipped;   // facts a naive evaluation would also have matched
+    u64 factsRetracted; // facts retracted because they depended on changed inputs
+    u64 cardsEvaluated; // cards fully re-evaluated
+} bb_program_stats;
+
+oc_str8 bb_debug_value_to_str8(oc_arena* arena, bb_value* value);
+
+bb_string* bb_string_acquire(bb_string_store* store, oc_str8 string);
+void bb_string_release(bb_string_store* store, bb_string* string);
+
+typedef struct bb_profile_entry
+{
+    bb_card* card;
+    bb_cell* cell; // when cell, or 0 for the card itself
+    bb_profile* profile;
+} bb_profile_entry;
+
+typedef struct bb_profile_list
+{
+    u32 count;
+    bb_profile_entry* entries;
+} bb_profile_list;
+
+bb_profile_list bb_program_collect_profiles(oc_arena* arena, bb_facts_db* factDb, oc_list cards, bool total);
+oc_str8 bb_profile_entry_label(oc_arena* arena, bb_profile_entry* entry);
+
+void bb_program_init_builtin_listeners(oc_arena* arena, bb_facts_db* factDb);
+void bb_program_init_builtin_responders(oc_arena* arena, bb_facts_db* factDb);
+bb_program_stats bb_program_update(oc_arena* frameArena, bb_facts_db* factDb, oc_list cards);
+
+//NOTE: stops the workers of the db and frees its memory, including the compiled code of its active cards. The
+//      listeners and responders are owned by the arena they were initialized with, except for the memoized
+//      answers of responders.
+void bb_fact_db_cleanup(bb_facts_db* factDb);
+
+#endif // __BB_ENGINE_H_
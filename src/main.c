@@ -5,6 +5,7 @@
 *
 **************************************************************************/
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,110 +14,97 @@
 #include <math.h>
 
 #include "orca.h"
+#include "engine.h"
 
 enum
 {
     SIDE_PANEL_WIDTH = 150,
 };
 
-typedef enum
-{
-    BB_CELL_HOLE,
-    BB_CELL_KEYWORD,
-    BB_CELL_OPERATOR,
-    BB_CELL_SYMBOL,
-    BB_CELL_CHAR,
-    BB_CELL_STRING,
-    BB_CELL_INT,
-    BB_CELL_FLOAT,
-    BB_CELL_COMMENT,
-    BB_CELL_PLACEHOLDER,
-
-    BB_CELL_LIST,
-
-} bb_cell_kind;
-
-typedef struct bb_cell bb_cell;
-
-struct bb_cell
+typedef struct bb_point
 {
-    oc_list_elt parentElt;
     bb_cell* parent;
-    oc_list children;
-    u32 childCount;
-
-    u64 id;
-    bb_cell_kind kind;
-    oc_str8 text;
-    u64 valU64;
-    f64 valF64;
+    bb_cell* leftFrom;
+    u32 offset;
 
-    oc_rect rect;
-    f32 lastLineWidth;
+} bb_point;
 
-    u32 lastEdit;
-    u32 lastFrame;
-    u32 lastRun;
+enum
+{
+    //NOTE: cell text is allocated from pools of 16, 32, ..., 512 bytes
+    BB_TEXT_MIN_SIZE = 16,
+    BB_TEXT_CLASS_COUNT = 6,
 };
 
-typedef struct bb_card
+//NOTE: metrics and glyph indices of the strings drawn by the editor, keyed by font, size and string. Runs are
+//      shared by layout and drawing, and the least recently used one is evicted when the cache is full.
+enum
 {
-    oc_list_elt listElt;
-
-    u32 id;
-    oc_rect rect;
-    oc_rect displayRect;
+    BB_TEXT_CACHE_CAPACITY = 2048,
+    BB_TEXT_CACHE_BUCKET_COUNT = 1024,
+};
 
-    bb_cell* root;
+typedef struct bb_text_run
+{
+    oc_list_elt bucketElt;
+    oc_list_elt lruElt;
+    u64 hash;
 
-    oc_str8 label;
-    u32 labelFrame;
+    oc_font font;
+    f32 fontSize;
+    oc_str8 string;
 
-    oc_color highlight;
-    u32 highlightFrame;
+    oc_str32 glyphs;
+    oc_str8 glyphBuffer;
+    oc_text_metrics metrics;
 
-    u32 whiskerFrame[4];
-    u32 whiskerBoldFrame[4];
+} bb_text_run;
 
-    oc_list variables;
+typedef struct bb_text_cache
+{
+    u32 count;
+    bb_text_run* runs;
+    oc_list lru; // most recently used first
+    oc_list buckets[BB_TEXT_CACHE_BUCKET_COUNT];
 
-    u64 clickedFrame;
-} bb_card;
+} bb_text_cache;
 
+//NOTE: thumbnails of inactive cards only show the cells that fit in the card's box. These cells are collected
+//      when the card changes, and drawn by a single draw proc rather than by a box per cell. Only the most
+//      recently drawn thumbnails are kept, and a card's thumbnail is recycled when the card becomes active.
 enum
 {
-    BB_WHISKER_DIRECTION_UP = 0,
-    BB_WHISKER_DIRECTION_LEFT,
-    BB_WHISKER_DIRECTION_DOWN,
-    BB_WHISKER_DIRECTION_RIGHT,
-    BB_WHISKER_DIRECTION_COUNT,
+    BB_THUMBNAIL_MAX_CELL_COUNT = 128,
+    BB_THUMBNAIL_MAX_COUNT = 256,
 };
 
-f32 BB_WHISKER_SIZE = 100;
-
-bool bb_cell_has_children(bb_cell* cell)
-{
-    return (cell->kind == BB_CELL_LIST);
-}
-
-bool bb_cell_has_text(bb_cell* cell)
-{
-    return (cell->kind >= BB_CELL_HOLE && cell->kind <= BB_CELL_PLACEHOLDER);
-}
-
-typedef struct bb_point
+struct bb_thumbnail
 {
-    bb_cell* parent;
-    bb_cell* leftFrom;
-    u32 offset;
+    oc_list_elt listElt;
+    bb_card* card;
 
-} bb_point;
+    u32 frame; // frame at which the cells were collected
+    u32 cellCount;
+    bb_cell* cells[BB_THUMBNAIL_MAX_CELL_COUNT];
+};
 
 typedef struct bb_cell_editor
 {
     oc_arena arena;
     u64 nextCellId;
 
+    //NOTE: cells and their text are recycled when deleted or replaced, so that memory is bounded by the
+    //      size of the programs, not by the number of edits.
+    oc_pool cellPool;
+    oc_pool textPools[BB_TEXT_CLASS_COUNT];
+    oc_pool thumbnailPool;
+    oc_list thumbnails; // most recently drawn first
+    u32 thumbnailCount;
+    u64 liveCellCount;
+    u64 freeCellCount;
+
+    bb_text_cache textCache;
+
     f32 spaceWidth;
     f32 lineHeight;
 
@@ -132,15 +120,71 @@ typedef struct bb_cell_editor
 
 } bb_cell_editor;
 
+void bb_cell_editor_init_pools(bb_cell_editor* editor)
+{
+    oc_pool_init(&editor->cellPool, sizeof(bb_cell));
+    oc_pool_init(&editor->thumbnailPool, sizeof(bb_thumbnail));
+    for(u32 i = 0; i < BB_TEXT_CLASS_COUNT; i++)
+    {
+        oc_pool_init(&editor->textPools[i], BB_TEXT_MIN_SIZE << i);
+    }
+}
+
 bb_cell* bb_cell_alloc(bb_cell_editor* editor, bb_cell_kind kind)
 {
-    bb_cell* cell = oc_arena_push_type(&editor->arena, bb_cell);
+    bb_cell* cell = oc_pool_alloc_type(&editor->cellPool, bb_cell);
     memset(cell, 0, sizeof(bb_cell));
     cell->id = editor->nextCellId++;
     cell->kind = kind;
+
+    editor->liveCellCount++;
+    if(editor->freeCellCount)
+    {
+        editor->freeCellCount--;
+    }
     return (cell);
 }
 
+u32 bb_cell_text_size_class(u64 len)
+{
+    u32 sizeClass = 0;
+    while(sizeClass < BB_TEXT_CLASS_COUNT && (BB_TEXT_MIN_SIZE << sizeClass) < len)
+    {
+        sizeClass++;
+    }
+    return (sizeClass);
+}
+
+char* bb_cell_text_alloc(bb_cell_editor* editor, u64 len)
+{
+    //NOTE: text that is too large for the biggest class is allocated on the heap
+    u32 sizeClass = bb_cell_text_size_class(len);
+    if(sizeClass < BB_TEXT_CLASS_COUNT)
+    {
+        return (oc_pool_alloc(&editor->textPools[sizeClass]));
+    }
+    else
+    {
+        return (malloc(len));
+    }
+}
+
+void bb_cell_text_recycle(bb_cell_editor* editor, oc_str8 text)
+{
+    if(text.ptr)
+    {
+        u32 sizeClass = bb_cell_text_size_class(text.len);
+        if(sizeClass < BB_TEXT_CLASS_COUNT)
+        {
+            oc_pool_recycle(&editor->textPools[sizeClass], text.ptr);
+        }
+        else
+        {
+            free(text.ptr);
+        }
+    }
+}
+
 void bb_cell_recycle(bb_cell_editor* editor, bb_cell* cell)
 {
     if(cell->parent)
@@ -154,42 +198,136 @@ void bb_cell_recycle(bb_cell_editor* editor, bb_cell* cell)
         bb_cell_recycle(editor, child);
     }
 
-    /*
-    if(cell->text.string.ptr)
+    bb_cell_text_recycle(editor, cell->text);
+    oc_pool_recycle(&editor->cellPool, cell);
+
+    editor->liveCellCount--;
+    editor->freeCellCount++;
+}
+
+void bb_cell_text_replace(bb_cell_editor* editor, bb_cell* cell, oc_str8 string)
+{
+    //NOTE: the text is kept in place if it stays in the same size class. The new string can be a slice of
+    //      the old text, so it's copied before the old text is recycled.
+    u32 sizeClass = bb_cell_text_size_class(string.len);
+    if(cell->text.ptr
+       && string.len
+       && sizeClass < BB_TEXT_CLASS_COUNT
+       && sizeClass == bb_cell_text_size_class(cell->text.len))
     {
-        free(cell->text.string.ptr);
+        memmove(cell->text.ptr, string.ptr, string.len);
+        cell->text.len = string.len;
+    }
+    else
+    {
+        oc_str8 text = { 0 };
+        if(string.len)
+        {
+            text = oc_str8_from_buffer(string.len, bb_cell_text_alloc(editor, string.len));
+            memcpy(text.ptr, string.ptr, string.len);
+        }
+        bb_cell_text_recycle(editor, cell->text);
+        cell->text = text;
     }
-    mem_pool_recycle(&tree->cellPool, cell);
-    */
 }
 
-void bb_cell_push(bb_cell* parent, bb_cell* cell)
+void bb_mark_modified(bb_cell_editor* editor, bb_cell* cell)
 {
-    OC_DEBUG_ASSERT(cell != parent);
-    cell->parent = parent;
-    oc_list_push_back(&parent->children, &cell->parentElt);
-    cell->parent->childCount++;
+    //NOTE: mark the cell and its ancestors, so that the card's root tells if anything in the card was edited
+    while(cell)
+    {
+        cell->lastEdit = editor->frame;
+        cell = cell->parent;
+    }
 }
 
-void bb_cell_insert(bb_cell* afterSibling, bb_cell* cell)
+//------------------------------------------------------------------------------------------
+// Text cache
+//------------------------------------------------------------------------------------------
+
+bb_text_run* bb_text_run_get(bb_cell_editor* editor, oc_font font, f32 fontSize, oc_str8 string)
 {
-    OC_DEBUG_ASSERT(cell != afterSibling->parent);
-    cell->parent = afterSibling->parent;
-    oc_list_insert(&cell->parent->children, &afterSibling->parentElt, &cell->parentElt);
-    cell->parent->childCount++;
+    bb_text_cache* cache = &editor->textCache;
+    if(!cache->runs)
+    {
+        cache->runs = oc_arena_push_array(&editor->arena, bb_text_run, BB_TEXT_CACHE_CAPACITY);
+    }
+
+    u64 hash = oc_hash_xx64_string_seed(string, font.h ^ ((u64)(fontSize * 64) << 32));
+    oc_list* bucket = &cache->buckets[hash % BB_TEXT_CACHE_BUCKET_COUNT];
+
+    oc_list_for(*bucket, run, bb_text_run, bucketElt)
+    {
+        if(run->hash == hash
+           && run->font.h == font.h
+           && run->fontSize == fontSize
+           && !oc_str8_cmp(run->string, string))
+        {
+            oc_list_remove(&cache->lru, &run->lruElt);
+            oc_list_push_front(&cache->lru, &run->lruElt);
+            return (run);
+        }
+    }
+
+    bb_text_run* run = 0;
+    if(cache->count < BB_TEXT_CACHE_CAPACITY)
+    {
+        run = &cache->runs[cache->count];
+        cache->count++;
+    }
+    else
+    {
+        //NOTE: evict the least recently used run, and recycle its buffers
+        run = oc_list_last_entry(cache->lru, bb_text_run, lruElt);
+        oc_list_remove(&cache->lru, &run->lruElt);
+        oc_list_remove(&cache->buckets[run->hash % BB_TEXT_CACHE_BUCKET_COUNT], &run->bucketElt);
+
+        bb_cell_text_recycle(editor, run->string);
+        bb_cell_text_recycle(editor, run->glyphBuffer);
+    }
+    memset(run, 0, sizeof(bb_text_run));
+
+    run->hash = hash;
+    run->font = font;
+    run->fontSize = fontSize;
+    run->metrics = oc_font_text_metrics(font, fontSize, string);
+
+    if(string.len)
+    {
+        run->string = oc_str8_from_buffer(string.len, bb_cell_text_alloc(editor, string.len));
+        memcpy(run->string.ptr, string.ptr, string.len);
+
+        oc_arena_scope scratch = oc_scratch_begin();
+        oc_str32 codePoints = oc_utf8_push_to_codepoints(scratch.arena, string);
+        if(codePoints.len)
+        {
+            u64 size = codePoints.len * sizeof(oc_utf32);
+            run->glyphBuffer = oc_str8_from_buffer(size, bb_cell_text_alloc(editor, size));
+            run->glyphs = oc_font_get_glyph_indices(font,
+                                                    codePoints,
+                                                    oc_str32_from_buffer(codePoints.len, (oc_utf32*)run->glyphBuffer.ptr));
+        }
+        oc_scratch_end(scratch);
+    }
+
+    oc_list_push_front(bucket, &run->bucketElt);
+    oc_list_push_front(&cache->lru, &run->lruElt);
+    return (run);
 }
 
-void bb_cell_insert_before(bb_cell* beforeSibling, bb_cell* cell)
+oc_text_metrics bb_text_metrics(bb_cell_editor* editor, f32 fontSize, oc_str8 string)
 {
-    OC_DEBUG_ASSERT(cell != beforeSibling->parent);
-    cell->parent = beforeSibling->parent;
-    oc_list_insert_before(&cell->parent->children, &beforeSibling->parentElt, &cell->parentElt);
-    cell->parent->childCount++;
+    return (bb_text_run_get(editor, editor->font, fontSize, string)->metrics);
 }
 
-void bb_cell_text_replace(bb_cell_editor* editor, bb_cell* cell, oc_str8 string)
+void bb_text_outlines(bb_cell_editor* editor, f32 fontSize, oc_str8 string)
 {
-    cell->text = oc_str8_push_copy(&editor->arena, string);
+    //NOTE: the current font and size of the canvas must be the editor's font and fontSize
+    bb_text_run* run = bb_text_run_get(editor, editor->font, fontSize, string);
+    if(run->glyphs.len)
+    {
+        oc_glyph_outlines(run->glyphs);
+    }
 }
 
 //------------------------------------------------------------------------------------------
@@ -264,10 +402,6 @@ bb_point bb_prev_point(bb_point point)
     return (point);
 }
 
-#define bb_cell_first_child(parent) oc_list_first_entry(((parent)->children), bb_cell, parentElt)
-#define bb_cell_last_child(parent) oc_list_last_entry(((parent)->children), bb_cell, parentElt)
-#define bb_cell_next_sibling(cell) oc_list_next_entry((cell), bb_cell, parentElt)
-#define bb_cell_prev_sibling(cell) oc_list_prev_entry((cell), bb_cell, parentElt)
 
 bb_point bb_next_point(bb_point point)
 {
@@ -553,7 +687,7 @@ oc_rect bb_cell_frame_box(bb_cell* cell)
 f32 bb_display_offset_for_text_index(bb_cell_editor* editor, oc_str8 text, u32 offset)
 {
     oc_str8 leftText = oc_str8_slice(text, 0, offset);
-    oc_text_metrics metrics = oc_font_text_metrics(editor->font, editor->fontSize, leftText);
+    oc_text_metrics metrics = bb_text_metrics(editor, editor->fontSize, leftText);
     return (metrics.logical.w);
 }
 
@@ -635,7 +769,7 @@ void bb_insert_at_cursor(bb_cell_editor* editor, bb_cell* cell)
     editor->cursor = (bb_point){ cell, 0, 0 };
     editor->mark = editor->cursor;
 
-    //bb_mark_modified(editor, cell->parent);
+    bb_mark_modified(editor, cell->parent);
 }
 
 void bb_insert_cell(bb_cell_editor* editor, bb_cell_kind kind)
@@ -683,415 +817,121 @@ void bb_insert_string_literal(bb_cell_editor* editor)
 }
 
 //------------------------------------------------------------------------------------
-// Lexing
+// Relexing
 //------------------------------------------------------------------------------------
 
-#define BB_TOKEN_KEYWORDS(X) \
-    X(KW_WHEN, "when")       \
-    X(KW_CLAIM, "claim")     \
-    X(KW_WISH, "wish")       \
-    X(KW_SELF, "self")       \
-    X(KW_VAR, "var")         \
-    X(KW_SET, "set")
-
-#define BB_TOKEN_OPERATORS(X) \
-    X(OP_ADD, "+")            \
-    X(OP_SUB, "-")
-
-enum
-{
-
-#define X(tok, str) OC_CAT2(BB_TOKEN_, tok),
-    BB_TOKEN_KEYWORDS(X) //
-    BB_TOKEN_OPERATORS(X)
-#undef X
-};
-
-typedef u32 bb_token;
-
-typedef struct bb_lex_entry
+void bb_relex_cell(bb_cell_editor* editor, bb_cell* cell, oc_str8 string)
 {
-    bb_token token;
-    oc_str8 string;
-} bb_lex_entry;
+    bb_mark_modified(editor, cell->parent);
 
-const bb_lex_entry BB_LEX_OPERATORS[] = {
-#define X(tok, str) { .token = OC_CAT2(BB_TOKEN_, tok), .string = OC_STR8_LIT(str) },
-    BB_TOKEN_OPERATORS(X)
-#undef X
-};
-const u32 BB_LEX_OPERATOR_COUNT = sizeof(BB_LEX_OPERATORS) / sizeof(bb_lex_entry);
+    bb_cell_kind srcKind = cell->kind;
+    bb_point cursorPoint = { .parent = cell, .leftFrom = 0, .offset = 0 };
+    oc_vec2 cursorPos = bb_point_to_display_pos(editor, cursorPoint);
+    bb_point nextPoint = editor->cursor;
+    u32 byteOffset = 0;
 
-const bb_lex_entry BB_LEX_KEYWORDS[] = {
-#define X(tok, str) { .token = OC_CAT2(BB_TOKEN_, tok), .string = OC_STR8_LIT(str) },
-    BB_TOKEN_KEYWORDS(X)
-#undef X
-};
-const u32 BB_LEX_KEYWORD_COUNT = sizeof(BB_LEX_KEYWORDS) / sizeof(bb_lex_entry);
+    do
+    {
+        bb_lex_result lex = bb_lex_next(string, byteOffset, srcKind);
+        byteOffset += lex.string.len;
 
-typedef struct bb_lex_result
-{
-    bb_cell_kind kind;
-    u64 valU64;
-    f64 valF64;
-    oc_str8 string;
-} bb_lex_result;
+        bb_cell_text_replace(editor, cell, lex.string);
+        cell->kind = lex.kind;
+        cell->valU64 = lex.valU64;
+        cell->valF64 = lex.valF64;
 
-bb_lex_result bb_lex_operator(oc_str8 string, u64 byteOffset)
-{
-    u64 startOffset = byteOffset;
-    u64 endOffset = byteOffset + 1;
+        cell->lastEdit = editor->frame;
 
-    while(endOffset < string.len)
-    {
-        char c = string.ptr[endOffset];
-        if(c == '+' || c == '-' || c == '*' || c == '/' || c == '%'
-           || c == '!' || c == '=' || c == '<' || c == '>')
-        {
-            endOffset += 1;
-        }
-        else
+        if(byteOffset < string.len)
         {
-            break;
-        }
-    }
-    bb_lex_result result = { .string = oc_str8_slice(string, startOffset, endOffset),
-                             .kind = BB_CELL_OPERATOR };
+            bb_cell* prevCell = cell;
+            cell = bb_cell_alloc(editor, BB_CELL_SYMBOL);
+            bb_cell_insert(prevCell, cell);
 
-    for(int i = 0; i < BB_LEX_OPERATOR_COUNT; i++)
-    {
-        if(!oc_str8_cmp(result.string, BB_LEX_OPERATORS[i].string))
-        {
-            result.valU64 = BB_LEX_OPERATORS[i].token;
-            break;
+            //NOTE: set default position and replace cursor if needed
+            cell->rect.x = cursorPos.x + bb_display_offset_for_text_index(editor, string, byteOffset);
+            cell->rect.y = cursorPos.y;
+
+            if(editor->cursor.offset >= byteOffset)
+            {
+                nextPoint.parent = cell;
+                nextPoint.offset = editor->cursor.offset - byteOffset;
+            }
+            cell->lastEdit = editor->frame;
         }
     }
+    while(byteOffset < string.len);
 
-    return (result);
+    editor->cursor = nextPoint;
+    editor->mark = editor->cursor;
 }
 
-bb_lex_result bb_lex_placeholder(oc_str8 string, u64 byteOffset)
+//------------------------------------------------------------------------------------
+// Text edition
+//------------------------------------------------------------------------------------
+
+void bb_replace_text_selection_with_utf8(bb_cell_editor* editor, u64 count, char* input)
 {
-    u64 startOffset = byteOffset;
-    u64 endOffset = byteOffset + 1;
+    bb_cell* cell = editor->cursor.parent;
+
+    u32 selStart = oc_min(editor->cursor.offset, editor->mark.offset);
+    u32 selEnd = oc_max(editor->cursor.offset, editor->mark.offset);
 
-    while(endOffset < string.len)
+    if(cell->kind == BB_CELL_HOLE)
     {
-        char c = string.ptr[endOffset];
-        if((c >= 'a' && c <= 'z')
-           || (c >= 'A' && c <= 'Z')
-           || (c >= '0' && c <= '9')
-           || c == '_')
-        {
-            endOffset += 1;
-        }
-        else
-        {
-            break;
-        }
+        selStart = 0;
+        selEnd = cell->text.len;
     }
-    bb_lex_result result = { .string = oc_str8_slice(string, startOffset, endOffset),
-                             .kind = BB_CELL_PLACEHOLDER };
-    return (result);
-}
 
-bb_lex_result bb_lex_identifier(oc_str8 string, u64 byteOffset)
-{
-    u64 startOffset = byteOffset;
-    u64 endOffset = byteOffset + oc_utf8_size_from_leading_char(string.ptr[startOffset]);
+    u64 newLen = cell->text.len + count - (selEnd - selStart);
 
-    while(endOffset < string.len)
-    {
-        char c = string.ptr[endOffset];
-        if((c >= 'a' && c <= 'z')
-           || (c >= 'A' && c <= 'Z')
-           || (c >= '0' && c <= '9')
-           || c == '_'
-           || c == ':')
-        {
-            endOffset += 1;
-        }
-        else
-        {
-            break;
-        }
-    }
-    bb_lex_result result = { .string = oc_str8_slice(string, startOffset, endOffset),
-                             .kind = BB_CELL_SYMBOL };
+    oc_arena_scope scratch = oc_scratch_begin();
 
-    return (result);
-}
+    oc_str8_list insertList = {};
+    oc_str8_list_push(scratch.arena, &insertList, oc_str8_slice(cell->text, 0, selStart));
+    oc_str8_list_push(scratch.arena, &insertList, oc_str8_from_buffer(count, input));
+    oc_str8_list_push(scratch.arena, &insertList, oc_str8_slice(cell->text, selEnd, cell->text.len));
 
-bb_lex_result bb_lex_identifier_or_keyword(oc_str8 string, u64 byteOffset)
-{
-    bb_lex_result result = bb_lex_identifier(string, byteOffset);
+    oc_str8 string = oc_str8_list_join(scratch.arena, insertList);
+    editor->cursor.offset = selStart + count;
 
-    for(int i = 0; i < BB_LEX_KEYWORD_COUNT; i++)
-    {
-        if(!oc_str8_cmp(result.string, BB_LEX_KEYWORDS[i].string))
-        {
-            result.kind = BB_CELL_KEYWORD;
-            result.valU64 = BB_LEX_KEYWORDS[i].token;
-            break;
-        }
-    }
+    editor->mark = editor->cursor;
 
-    return (result);
+    bb_relex_cell(editor, cell, string);
+    //cell->kind = BB_CELL_SYMBOL;
+
+    oc_scratch_end(scratch);
 }
 
-bb_lex_result bb_lex_number(oc_str8 string, u64 byteOffset)
-{
-    u64 startOffset = byteOffset;
-    u64 endOffset = byteOffset;
+//------------------------------------------------------------------------------------
+// Deletion
+//------------------------------------------------------------------------------------
 
-    u64 numberU64 = 0;
-    while(endOffset < string.len)
+void bb_delete(bb_cell_editor* editor)
+{
+    if(!bb_point_same_cell(editor->cursor, editor->mark))
     {
-        char c = string.ptr[endOffset];
-        if(c >= '0' && c <= '9')
-        {
-            numberU64 *= 10;
-            numberU64 += c - '0';
-            endOffset += 1;
-        }
-        else
+        bb_cell_span span = bb_cell_span_from_points(editor->cursor, editor->mark);
+        bb_cell* parent = span.start->parent;
+        bb_cell* stop = bb_cell_next_sibling(span.end);
+
+        bb_cell* cell = span.start;
+        while(cell != stop)
         {
-            break;
+            bb_cell* nextCell = bb_cell_next_sibling(cell);
+            bb_cell_recycle(editor, cell);
+            cell = nextCell;
         }
-    }
-
-    bb_lex_result result = {};
+        editor->cursor = (bb_point){ parent, stop, 0 };
+        editor->mark = editor->cursor;
 
-    f64 numberF64;
-    if(endOffset < string.len
-       && string.ptr[endOffset] == '.'
-       && (endOffset + 1 >= string.len
-           || string.ptr[endOffset + 1] != '.'))
+        bb_mark_modified(editor, parent);
+    }
+    else if(!editor->cursor.leftFrom && bb_cell_has_text(editor->cursor.parent))
     {
-        endOffset += 1;
-
-        u64 decimals = 0;
-        u64 decimalCount = 0;
-
-        while(endOffset < string.len)
-        {
-            char c = string.ptr[endOffset];
-            if(c >= '0' && c <= '9')
-            {
-                decimals *= 10;
-                decimals += c - '0';
-                endOffset += 1;
-                decimalCount += 1;
-            }
-            else
-            {
-                break;
-            }
-        }
-        result.kind = BB_CELL_FLOAT;
-        result.string = oc_str8_slice(string, startOffset, endOffset);
-        result.valF64 = (f64)numberU64 + (f64)decimals / pow(10, decimalCount);
-    }
-    else
-    {
-        result.kind = BB_CELL_INT;
-        result.string = oc_str8_slice(string, startOffset, endOffset);
-        result.valU64 = numberU64;
-    }
-    return (result);
-}
-
-bb_lex_result bb_lex_error(oc_str8 string, u64 byteOffset)
-{
-    bb_lex_result result = { 0 };
-
-    u64 startOffset = byteOffset;
-    u64 endOffset = startOffset;
-
-    while(endOffset < string.len)
-    {
-        oc_utf8_dec decode = oc_utf8_decode_at(string, endOffset);
-        oc_utf32 c = decode.codepoint;
-
-        if((c == '$')
-           || (c >= 'a' && c <= 'z')
-           || (c >= 'A' && c <= 'Z')
-           || (c >= '0' && c <= '9')
-           || (c == '_')
-           || (c == '+' || c == '-' || c == '*' || c == '/' || c == '%'
-               || c == '!' || c == '=' || c == '<' || c == '>'))
-        {
-            goto end;
-        }
-        endOffset += decode.size;
-    }
-end:
-    result = (bb_lex_result){ .string = oc_str8_slice(string, startOffset, endOffset),
-                              .kind = BB_CELL_SYMBOL };
-    return (result);
-}
-
-bb_lex_result bb_lex_next(oc_str8 string, u64 byteOffset, bb_cell_kind srcKind)
-{
-    bb_lex_result result = {};
-
-    if(srcKind == BB_CELL_STRING
-       || srcKind == BB_CELL_COMMENT)
-    {
-        //TODO for quote, set valU64?
-        result.string = oc_str8_slice(string, byteOffset, string.len);
-        result.kind = srcKind;
-    }
-    else if(byteOffset >= string.len)
-    {
-        //WARN: hole
-        result.string = (oc_str8){ 0 };
-        result.kind = BB_CELL_HOLE;
-    }
-    else
-    {
-        oc_utf8_dec decode = oc_utf8_decode_at(string, byteOffset);
-        oc_utf32 c = decode.codepoint;
-
-        if(c == '$')
-        {
-            result = bb_lex_placeholder(string, byteOffset);
-        }
-        else if((c >= 'a' && c <= 'z')
-                || (c >= 'A' && c <= 'Z')
-                || c == '_')
-        {
-            result = bb_lex_identifier_or_keyword(string, byteOffset);
-        }
-        else if(c == '+' || c == '-' || c == '*' || c == '/' || c == '%'
-                || c == '!' || c == '=' || c == '<' || c == '>')
-        {
-            result = bb_lex_operator(string, byteOffset);
-        }
-        else if(c >= '0' && c <= '9')
-        {
-            result = bb_lex_number(string, byteOffset);
-        }
-        else
-        {
-            result = bb_lex_error(string, byteOffset);
-        }
-    }
-    return (result);
-}
-
-void bb_relex_cell(bb_cell_editor* editor, bb_cell* cell, oc_str8 string)
-{
-    //	bb_mark_modified(editor, cell->parent);
-
-    bb_cell_kind srcKind = cell->kind;
-    bb_point cursorPoint = { .parent = cell, .leftFrom = 0, .offset = 0 };
-    oc_vec2 cursorPos = bb_point_to_display_pos(editor, cursorPoint);
-    bb_point nextPoint = editor->cursor;
-    u32 byteOffset = 0;
-
-    do
-    {
-        bb_lex_result lex = bb_lex_next(string, byteOffset, srcKind);
-        byteOffset += lex.string.len;
-
-        bb_cell_text_replace(editor, cell, lex.string);
-        cell->kind = lex.kind;
-        cell->valU64 = lex.valU64;
-        cell->valF64 = lex.valF64;
-
-        cell->lastEdit = editor->frame;
-
-        if(byteOffset < string.len)
-        {
-            bb_cell* prevCell = cell;
-            cell = bb_cell_alloc(editor, BB_CELL_SYMBOL);
-            bb_cell_insert(prevCell, cell);
-
-            //NOTE: set default position and replace cursor if needed
-            cell->rect.x = cursorPos.x + bb_display_offset_for_text_index(editor, string, byteOffset);
-            cell->rect.y = cursorPos.y;
-
-            if(editor->cursor.offset >= byteOffset)
-            {
-                nextPoint.parent = cell;
-                nextPoint.offset = editor->cursor.offset - byteOffset;
-            }
-            cell->lastEdit = editor->frame;
-        }
-    }
-    while(byteOffset < string.len);
-
-    editor->cursor = nextPoint;
-    editor->mark = editor->cursor;
-}
-
-//------------------------------------------------------------------------------------
-// Text edition
-//------------------------------------------------------------------------------------
-
-void bb_replace_text_selection_with_utf8(bb_cell_editor* editor, u64 count, char* input)
-{
-    bb_cell* cell = editor->cursor.parent;
-
-    u32 selStart = oc_min(editor->cursor.offset, editor->mark.offset);
-    u32 selEnd = oc_max(editor->cursor.offset, editor->mark.offset);
-
-    if(cell->kind == BB_CELL_HOLE)
-    {
-        selStart = 0;
-        selEnd = cell->text.len;
-    }
-
-    u64 newLen = cell->text.len + count - (selEnd - selStart);
-
-    oc_arena_scope scratch = oc_scratch_begin();
-
-    oc_str8_list insertList = {};
-    oc_str8_list_push(scratch.arena, &insertList, oc_str8_slice(cell->text, 0, selStart));
-    oc_str8_list_push(scratch.arena, &insertList, oc_str8_from_buffer(count, input));
-    oc_str8_list_push(scratch.arena, &insertList, oc_str8_slice(cell->text, selEnd, cell->text.len));
-
-    oc_str8 string = oc_str8_list_join(scratch.arena, insertList);
-    editor->cursor.offset = selStart + count;
-
-    editor->mark = editor->cursor;
-
-    bb_relex_cell(editor, cell, string);
-    //cell->kind = BB_CELL_SYMBOL;
-
-    oc_scratch_end(scratch);
-}
-
-//------------------------------------------------------------------------------------
-// Deletion
-//------------------------------------------------------------------------------------
-
-void bb_delete(bb_cell_editor* editor)
-{
-    if(!bb_point_same_cell(editor->cursor, editor->mark))
-    {
-        bb_cell_span span = bb_cell_span_from_points(editor->cursor, editor->mark);
-        bb_cell* parent = span.start->parent;
-        bb_cell* stop = bb_cell_next_sibling(span.end);
-
-        bb_cell* cell = span.start;
-        while(cell != stop)
-        {
-            bb_cell* nextCell = bb_cell_next_sibling(cell);
-            bb_cell_recycle(editor, cell);
-            cell = nextCell;
-        }
-        editor->cursor = (bb_point){ parent, stop, 0 };
-        editor->mark = editor->cursor;
-
-        //		bb_mark_modified(editor, parent);
-    }
-    else if(!editor->cursor.leftFrom && bb_cell_has_text(editor->cursor.parent))
-    {
-        bb_replace_text_selection_with_utf8(editor, 0, 0);
-    }
-}
+        bb_replace_text_selection_with_utf8(editor, 0, 0);
+    }
+}
 
 //------------------------------------------------------------------------------------
 // Parenthesize
@@ -1537,6 +1377,21 @@ typedef struct cell_layout_result
 
 cell_layout_result cell_update_layout(bb_cell_editor* editor, bb_cell* cell, oc_vec2 pos)
 {
+    //NOTE: edits mark the edited cell and its ancestors, so only the cells on the path from edited cells to the
+    //      root are laid out again. Other cells reuse the layout they got after their last edit, and are just
+    //      moved to their new position.
+    if(cell->layoutFrame && cell->lastEdit < cell->layoutFrame)
+    {
+        cell->layoutRect.x = pos.x;
+        cell->layoutRect.y = pos.y;
+
+        return ((cell_layout_result){
+            .rect = cell->layoutRect,
+            .lastLineWidth = cell->lastLineWidth,
+            .vertical = cell->layoutVertical,
+        });
+    }
+
     cell_layout_result result = {
         .rect = {
             .x = pos.x,
@@ -1553,7 +1408,7 @@ cell_layout_result cell_update_layout(bb_cell_editor* editor, bb_cell* cell, oc_
         {
             text = cell->text;
         }
-        oc_text_metrics metrics = oc_font_text_metrics(editor->font, editor->fontSize, text);
+        oc_text_metrics metrics = bb_text_metrics(editor, editor->fontSize, text);
 
         result.rect.w = metrics.logical.w;
         result.rect.w += bb_cell_left_decorator_width(editor, cell);
@@ -1684,8 +1539,8 @@ cell_layout_result cell_update_layout(bb_cell_editor* editor, bb_cell* cell, oc_
                 //------------------------------------------------------------------
                 //NOTE(martin): set children relative coordinates and adjust widths
                 //------------------------------------------------------------------
-                child->rect.x = childPos.x;
-                child->rect.y = childPos.y;
+                child->layoutRect.x = childPos.x;
+                child->layoutRect.y = childPos.y;
 
                 childPos.x += childResults[childIndex].rect.w;
                 lineHeight = oc_max(lineHeight, childResults[childIndex].rect.h);
@@ -1714,16 +1569,28 @@ cell_layout_result cell_update_layout(bb_cell_editor* editor, bb_cell* cell, oc_
 
         oc_scratch_end(scratch);
     }
-    cell->rect = result.rect;
+    cell->layoutRect = result.rect;
     cell->lastLineWidth = result.lastLineWidth;
+    cell->layoutVertical = result.vertical;
+    cell->layoutFrame = editor->frame;
+    cell->layoutChanged = true;
 
     return result;
 }
 
 void cell_update_rects(bb_cell_editor* editor, bb_cell* cell, oc_vec2 origin)
 {
-    cell->rect.x += origin.x;
-    cell->rect.y += origin.y;
+    oc_rect rect = cell->layoutRect;
+    rect.x += origin.x;
+    rect.y += origin.y;
+
+    //NOTE: subtrees that were not laid out again and didn't move keep their rects
+    if(!cell->layoutChanged && rect.x == cell->rect.x && rect.y == cell->rect.y)
+    {
+        return;
+    }
+    cell->rect = rect;
+    cell->layoutChanged = false;
 
     oc_vec2 childOrigin = { cell->rect.x, cell->rect.y };
     childOrigin.x += bb_cell_left_decorator_width(editor, cell);
@@ -1741,12 +1608,8 @@ typedef struct bb_box_draw_proc_data
 
 } bb_box_draw_proc_data;
 
-void bb_box_draw_proc(oc_ui_box* box, void* usr)
+void bb_cell_draw(bb_cell_editor* editor, bb_cell* cell, oc_rect rect)
 {
-    bb_box_draw_proc_data* data = (bb_box_draw_proc_data*)usr;
-    bb_cell* cell = data->cell;
-    bb_cell_editor* editor = data->editor;
-
     /*
     if(cell->id == 0)
     {
@@ -1770,7 +1633,7 @@ void bb_box_draw_proc(oc_ui_box* box, void* usr)
     }
 
     oc_set_width(1);
-    oc_rectangle_stroke(box->rect.x, box->rect.y, box->rect.w, box->rect.h);
+    oc_rectangle_stroke(rect.x, rect.y, rect.w, rect.h);
     */
 
     oc_str8 leftSep = { 0 };
@@ -1819,14 +1682,14 @@ void bb_box_draw_proc(oc_ui_box* box, void* usr)
     oc_set_font(editor->font);
     oc_set_font_size(editor->fontSize);
 
-    oc_vec2 pos = { box->rect.x, box->rect.y + editor->fontMetrics.ascent };
+    oc_vec2 pos = { rect.x, rect.y + editor->fontMetrics.ascent };
     if(leftSep.len)
     {
         oc_move_to(pos.x, pos.y);
-        oc_text_outlines(leftSep);
+        bb_text_outlines(editor, editor->fontSize, leftSep);
         oc_fill();
 
-        pos.x += oc_font_text_metrics(editor->font, editor->fontSize, leftSep).logical.w;
+        pos.x += bb_text_metrics(editor, editor->fontSize, leftSep).logical.w;
     }
 
     if(cell->text.len)
@@ -1835,25 +1698,71 @@ void bb_box_draw_proc(oc_ui_box* box, void* usr)
         oc_set_font_size(editor->fontSize);
 
         oc_move_to(pos.x, pos.y);
-        oc_text_outlines(cell->text);
+        bb_text_outlines(editor, editor->fontSize, cell->text);
         oc_fill();
     }
 
     if(rightSep.len)
     {
-        f32 w = oc_font_text_metrics(editor->font, editor->fontSize, rightSep).logical.w;
+        f32 w = bb_text_metrics(editor, editor->fontSize, rightSep).logical.w;
 
-        oc_move_to(box->rect.x + cell->lastLineWidth - w,
-                   box->rect.y + box->rect.h - editor->lineHeight + editor->fontMetrics.ascent);
-        oc_text_outlines(rightSep);
+        oc_move_to(rect.x + cell->lastLineWidth - w,
+                   rect.y + rect.h - editor->lineHeight + editor->fontMetrics.ascent);
+        bb_text_outlines(editor, editor->fontSize, rightSep);
         oc_fill();
     }
 }
 
-void build_cell_ui(oc_arena* arena, bb_cell_editor* editor, bb_cell* cell)
+void bb_box_draw_proc(oc_ui_box* box, void* usr)
+{
+    bb_box_draw_proc_data* data = (bb_box_draw_proc_data*)usr;
+    bb_cell_draw(data->editor, data->cell, box->rect);
+}
+
+//NOTE: keys of the boxes of cards and cells are made from their ids, which are stable across frames. They're
+//      written to a buffer on the stack rather than formatted in the scratch arena, since the ui copies them.
+enum
+{
+    BB_UI_KEY_MAX_SIZE = 32,
+};
+
+oc_str8 bb_ui_key(char* buffer, const char* prefix, u64 id)
+{
+    u64 len = strlen(prefix);
+    memcpy(buffer, prefix, len);
+
+    char digits[20];
+    u32 digitCount = 0;
+    do
+    {
+        digits[digitCount++] = '0' + (id % 10);
+        id /= 10;
+    }
+    while(id);
+
+    while(digitCount)
+    {
+        buffer[len++] = digits[--digitCount];
+    }
+    return (oc_str8_from_buffer(len, buffer));
+}
+
+void build_cell_ui(oc_arena* arena, bb_cell_editor* editor, bb_cell* cell, oc_rect* clip)
 {
-    oc_arena_scope scratch = oc_scratch_begin_next(arena);
-    oc_str8 key = oc_str8_pushf(scratch.arena, "cell-%u", cell->id);
+    //NOTE: the rect of a cell contains its children, so cells outside of the clip rect are culled with their subtree
+    if(clip
+       && (clip->w <= 0
+           || clip->h <= 0
+           || cell->rect.x >= clip->x + clip->w
+           || cell->rect.y >= clip->y + clip->h
+           || cell->rect.x + cell->rect.w <= clip->x
+           || cell->rect.y + cell->rect.h <= clip->y))
+    {
+        return;
+    }
+
+    char keyBuffer[BB_UI_KEY_MAX_SIZE];
+    oc_str8 key = bb_ui_key(keyBuffer, "cell-", cell->id);
 
     oc_ui_style_next(&(oc_ui_style){
                          .floating = { true, true },
@@ -1869,1358 +1778,293 @@ void build_cell_ui(oc_arena* arena, bb_cell_editor* editor, bb_cell* cell)
     data->cell = cell;
     data->editor = editor;
     oc_ui_box_set_draw_proc(box, bb_box_draw_proc, data);
-
-    oc_scratch_end(scratch);
-
-    oc_list_for(cell->children, child, bb_cell, parentElt)
-    {
-        build_cell_ui(arena, editor, child);
-    }
-}
-
-void bb_draw_cursor(bb_cell_editor* editor)
-{
-    oc_vec2 cursorPos = bb_point_to_display_pos(editor, editor->cursor);
-
-    oc_set_color_rgba(0.95, 0.71, 0.25, 1);
-    oc_rectangle_fill(cursorPos.x - 2, cursorPos.y, 4, editor->lineHeight);
-}
-
-void bb_draw_sibling_marker(bb_cell_editor* editor, bb_cell* cell, oc_color color)
-{
-    f32 lineHeight = editor->lineHeight;
-
-    oc_set_color(color);
-    oc_set_width(4);
-    oc_move_to(cell->rect.x, cell->rect.y + cell->rect.h - 2);
-    oc_line_to(cell->rect.x + cell->lastLineWidth, cell->rect.y + cell->rect.h - 2);
-    oc_stroke();
-}
-
-void bb_draw_edit_range(bb_cell_editor* editor)
-{
-    f32 spaceWidth = editor->spaceWidth;
-    f32 lineHeight = editor->lineHeight;
-
-    bb_point cursor = editor->cursor;
-    bb_point mark = editor->mark;
-
-    if(!bb_point_same_cell(cursor, mark))
-    {
-        //NOTE(martin): multiple nodes are selected, highlight the selection (in blue)
-        bb_cell_span span = bb_cell_span_from_points(cursor, mark);
-        bb_cell* parent = span.start->parent;
-        bb_cell* stop = bb_cell_next_sibling(span.end);
-
-        oc_rect startBox = bb_cell_frame_box(span.start);
-        oc_rect box = startBox;
-        oc_rect endBox = startBox;
-
-        for(bb_cell* cell = span.start; cell != stop; cell = bb_cell_next_sibling(cell))
-        {
-            endBox = bb_cell_frame_box(cell);
-            box = bb_combined_box(box, endBox);
-        }
-
-        oc_rect firstLine = {
-            startBox.x,
-            startBox.y,
-            oc_max(0, box.x + box.w - startBox.x),
-            lineHeight,
-        };
-
-        oc_rect innerSpan = {
-            box.x,
-            box.y + lineHeight,
-            box.w,
-            oc_max(0, box.h - 2 * lineHeight),
-        };
-
-        oc_rect lastLine = {
-            box.x,
-            box.y + box.h - lineHeight,
-            oc_max(0, endBox.x + endBox.w - box.x),
-            oc_max(0, endBox.y + endBox.h - (box.y + box.h - lineHeight)),
-        };
-
-        oc_set_color_rgba(0.2, 0.2, 1, 1);
-
-        oc_rectangle_fill(firstLine.x, firstLine.y, firstLine.w, firstLine.h);
-        oc_rectangle_fill(innerSpan.x, innerSpan.y, innerSpan.w, innerSpan.h);
-        oc_rectangle_fill(lastLine.x, lastLine.y, lastLine.w, lastLine.h);
-
-        bb_draw_cursor(editor);
-    }
-    else
-    {
-        //NOTE(martin): shade the parent cell of cursor/mark
-        oc_rect parentBox = bb_cell_contents_box(editor, cursor.parent);
-        oc_set_color_rgba(0.2, 0.2, 0.2, 1);
-        oc_rectangle_fill(parentBox.x, parentBox.y, parentBox.w, parentBox.h);
-
-        if(!cursor.leftFrom
-           && (bb_cell_has_text(cursor.parent))
-           && cursor.offset != mark.offset)
-        {
-            //NOTE(martin): some text is selected. Highlight the selection (in blue).
-            oc_rect box = bb_cell_contents_box(editor, cursor.parent);
-
-            u64 start = oc_min(cursor.offset, mark.offset);
-            u64 end = oc_max(cursor.offset, mark.offset);
-
-            oc_str8 string = cursor.parent->text;
-            oc_rect leftBox = oc_font_text_metrics(editor->font, editor->fontSize, oc_str8_slice(string, 0, start)).logical;
-            oc_rect selBox = oc_font_text_metrics(editor->font, editor->fontSize, oc_str8_slice(string, start, end)).logical;
-
-            selBox.x += box.x + leftBox.w;
-            selBox.y = box.y;
-
-            oc_set_color_rgba(0.2, 0.2, 1, 1);
-            oc_rectangle_fill(selBox.x, selBox.y, selBox.w, selBox.h);
-
-            //  editor->animatedCursor = bb_point_to_display_pos(editor, editor->cursor);
-        }
-        else
-        {
-            bb_draw_cursor(editor);
-        }
-    }
-    //NOTE(martin): underline cells to the left/right of cursor
-    bb_cell* leftSibling = bb_point_left_cell(cursor);
-    bb_cell* rightSibling = bb_point_right_cell(cursor);
-
-    if(leftSibling)
-    {
-        bb_draw_sibling_marker(editor, leftSibling, (oc_color){ 0.2, 0.5, 1, 1 });
-    }
-    if(rightSibling)
-    {
-        bb_draw_sibling_marker(editor, rightSibling, (oc_color){ 0, 1, 0, 1 });
-    }
-}
-
-void bb_editor_draw_proc(oc_ui_box* box, void* data)
-{
-    bb_cell_editor* editor = (bb_cell_editor*)data;
-
-    oc_matrix_push((oc_mat2x3){
-        1, 0, box->rect.x,
-        0, 1, box->rect.y });
-
-    bb_draw_edit_range(editor);
-    oc_matrix_pop();
-}
-
-void bb_card_draw_cells(oc_arena* frameArena, bb_cell_editor* editor, bb_card* card)
-{
-    oc_ui_box* box = oc_ui_container("cells", OC_UI_FLAG_DRAW_PROC)
-    {
-        if(card->root)
-        {
-            cell_update_layout(editor, card->root, (oc_vec2){ 10, 20 });
-            cell_update_rects(editor, card->root, (oc_vec2){ 0 });
-            build_cell_ui(frameArena, editor, card->root);
-        }
-    }
-
-    if(editor->editedCard == card)
-    {
-        oc_ui_box_set_draw_proc(box, bb_editor_draw_proc, editor);
-    }
-    else
-    {
-        oc_ui_box_set_draw_proc(box, 0, editor);
-    }
-}
-
-//------------------------------------------------------------------------------------------------
-// Rule system
-//------------------------------------------------------------------------------------------------
-
-typedef enum
-{
-    BB_VALUE_SYMBOL,
-    BB_VALUE_STRING,
-    BB_VALUE_U64,
-    BB_VALUE_F64,
-    BB_VALUE_CARD_ID,
-
-    BB_VALUE_LIST,
-
-    BB_VALUE_PLACEHOLDER,
-
-} bb_value_kind;
-
-typedef struct bb_value
-{
-    oc_list_elt parentElt;
-    oc_list children;
-
-    bb_value_kind kind;
-
-    oc_str8 string;
-    u64 valU64;
-    f64 valF64;
-
-} bb_value;
-
-typedef struct bb_fact
-{
-    oc_list_elt listElt;
-    bb_value* root;
-    u32 iteration;
-} bb_fact;
-
-typedef struct bb_facts_db bb_facts_db;
-
-typedef struct bb_bound_val
-{
-    oc_list_elt listElt;
-    oc_list_elt cardElt;
-    oc_str8 name;
-    bb_value* value;
-
-    bb_value storedValue;
-} bb_bound_val;
-
-typedef struct bb_binding_scope
-{
-    oc_list_elt listElt;
-    oc_list bindings;
-
-} bb_binding_scope;
-
-typedef struct bb_bindings
-{
-    oc_list scopes;
-} bb_bindings;
-
-typedef void (*bb_listener_proc)(bb_value* match, bb_bindings* bindings, bb_facts_db* factDb, oc_list cards);
-
-typedef struct bb_listener
-{
-    oc_list_elt listElt;
-    bb_value* pattern;
-    bb_listener_proc proc;
-    u32 lastRun;
-
-} bb_listener;
-
-typedef bb_fact* (*bb_responder_proc)(oc_arena* arena, bb_facts_db* factDb, bb_value* query, bb_bindings* queryBindings, oc_list* factBindings);
-
-typedef struct bb_responder
-{
-    oc_list_elt listElt;
-    bb_value* pattern;
-    bb_responder_proc proc;
-
-} bb_responder;
-
-typedef struct bb_facts_db
-{
-    oc_arena persistentArena;
-
-    u32 factCount;
-    oc_list facts;
-
-    oc_list cards;
-    oc_list listeners;
-    oc_list responders;
-
-    u32 frame;
-    u32 iteration;
-
-} bb_facts_db;
-
-oc_list bb_program_match_pattern_against_facts(oc_arena* arena, bb_facts_db* factDb, bb_value* pattern);
-
-void bb_fact_db_push(oc_arena* arena, bb_facts_db* factDb, oc_list children)
-{
-    //NOTE: check if fact is already in db
-    bb_value root = {
-        .kind = BB_VALUE_LIST,
-        .children = children,
-    };
-    oc_list matches = bb_program_match_pattern_against_facts(arena, factDb, &root);
-
-    if(oc_list_empty(matches))
-    {
-        bb_fact* fact = oc_arena_push_type(arena, bb_fact);
-
-        fact->iteration = factDb->iteration;
-
-        fact->root = oc_arena_push_type(arena, bb_value);
-        memset(fact->root, 0, sizeof(bb_value));
-        fact->root->kind = BB_VALUE_LIST;
-        fact->root->children = children;
-
-        oc_list_push_back(&factDb->facts, &fact->listElt);
-        factDb->factCount++;
-    }
-}
-
-void bb_debug_print_value(bb_value* value)
-{
-    switch(value->kind)
-    {
-        case BB_VALUE_SYMBOL:
-        case BB_VALUE_PLACEHOLDER:
-            printf("%.*s", oc_str8_ip(value->string));
-            break;
-
-        case BB_VALUE_STRING:
-            printf("\"%.*s\"", oc_str8_ip(value->string));
-            break;
-
-        case BB_VALUE_U64:
-            printf("%llu", value->valU64);
-            break;
-
-        case BB_VALUE_F64:
-            printf("%f", value->valF64);
-            break;
-
-        case BB_VALUE_CARD_ID:
-            printf("card-%llu", value->valU64);
-            break;
-
-        case BB_VALUE_LIST:
-        {
-            printf("(");
-            oc_list_for(value->children, child, bb_value, parentElt)
-            {
-                bb_debug_print_value(child);
-                if(child->parentElt.next)
-                {
-                    printf(" ");
-                }
-            }
-            printf(")");
-        }
-        break;
-    }
-}
-
-oc_str8 bb_debug_value_to_str8(oc_arena* arena, bb_value* value)
-{
-    oc_str8 str = { 0 };
-    switch(value->kind)
-    {
-        case BB_VALUE_SYMBOL:
-        case BB_VALUE_PLACEHOLDER:
-            str = oc_str8_pushf(arena, "%.*s", oc_str8_ip(value->string));
-            break;
-
-        case BB_VALUE_STRING:
-            str = oc_str8_pushf(arena, "\"%.*s\"", oc_str8_ip(value->string));
-            break;
-
-        case BB_VALUE_U64:
-            str = oc_str8_pushf(arena, "%llu", value->valU64);
-            break;
-
-        case BB_VALUE_F64:
-            str = oc_str8_pushf(arena, "%f", value->valF64);
-            break;
-
-        case BB_VALUE_CARD_ID:
-            str = oc_str8_pushf(arena, "card-%llu", value->valU64);
-            break;
-
-        case BB_VALUE_LIST:
-        {
-            oc_str8_list list = { 0 };
-
-            oc_str8_list_pushf(arena, &list, "(");
-            oc_list_for(value->children, child, bb_value, parentElt)
-            {
-                oc_str8_list_push(arena, &list, bb_debug_value_to_str8(arena, child));
-                if(child->parentElt.next)
-                {
-                    oc_str8_list_pushf(arena, &list, " ");
-                }
-            }
-            oc_str8_list_pushf(arena, &list, ")");
-            str = oc_str8_list_join(arena, list);
-        }
-        break;
-    }
-    return (str);
-}
-
-void bb_debug_print_facts(bb_facts_db* factDb)
-{
-    printf("Facts:\n");
-    i32 factIndex = 0;
-    oc_list_for(factDb->facts, fact, bb_fact, listElt)
-    {
-        printf("\tfact #%i:\n\t\t", factIndex);
-        bb_debug_print_value(fact->root);
-
-        printf("\n");
-        factIndex++;
-    }
-}
-
-bb_value* bb_find_binding(bb_bindings* bindings, oc_str8 name)
-{
-    bb_value* value = 0;
-
-    oc_list_for(bindings->scopes, scope, bb_binding_scope, listElt)
-    {
-        oc_list_for(scope->bindings, binding, bb_bound_val, listElt)
-        {
-            if(!oc_str8_cmp(binding->name, name))
-            {
-                value = binding->value;
-                break;
-            }
-        }
-    }
-    return value;
-}
-
-bb_bound_val* bb_find_var(bb_bindings* bindings, oc_str8 name)
-{
-    bb_bound_val* result = 0;
-
-    oc_list_for(bindings->scopes, scope, bb_binding_scope, listElt)
-    {
-        oc_list_for(scope->bindings, binding, bb_bound_val, listElt)
-        {
-            if(!oc_str8_cmp(binding->name, name))
-            {
-                result = binding;
-                break;
-            }
-        }
-    }
-    return result;
-}
-
-bb_value* bb_program_eval_pattern(oc_arena* arena, bb_card* card, bb_cell* cell, bb_bindings* bindings)
-{
-    bb_value* result = oc_arena_push_type(arena, bb_value);
-    memset(result, 0, sizeof(bb_value));
-
-    if(cell->kind == BB_CELL_LIST)
-    {
-        bb_cell* head = oc_list_first_entry(cell->children, bb_cell, parentElt);
-        if(head && head->kind == BB_CELL_OPERATOR)
-        {
-            if(head->valU64 == BB_TOKEN_OP_ADD
-               || head->valU64 == BB_TOKEN_OP_SUB)
-            {
-                bb_cell* lhsCell = oc_list_next_entry(head, bb_cell, parentElt);
-                if(lhsCell)
-                {
-                    bb_value* lhs = bb_program_eval_pattern(arena, card, lhsCell, bindings);
-                    bb_cell* rhsCell = oc_list_next_entry(lhsCell, bb_cell, parentElt);
-                    if(rhsCell)
-                    {
-                        bb_value* rhs = bb_program_eval_pattern(arena, card, rhsCell, bindings);
-
-                        if(lhs->kind == BB_VALUE_F64 || rhs->kind == BB_VALUE_F64)
-                        {
-                            f64 lhsValue = lhs->valF64;
-                            f64 rhsValue = rhs->valF64;
-                            if(lhs->kind == BB_VALUE_U64)
-                            {
-                                lhsValue = (f64)lhs->valU64;
-                            }
-                            if(rhs->kind == BB_VALUE_U64)
-                            {
-                                rhsValue = (f64)rhs->valU64;
-                            }
-                            result->kind = BB_VALUE_F64;
-                            if(head->valU64 == BB_TOKEN_OP_ADD)
-                            {
-                                result->valU64 = lhsValue + rhsValue;
-                            }
-                            else
-                            {
-                                result->valU64 = lhsValue - rhsValue;
-                            }
-                        }
-                        else
-                        {
-                            result->kind = BB_VALUE_U64;
-                            if(head->valU64 == BB_TOKEN_OP_ADD)
-                            {
-                                result->valU64 = lhs->valU64 + rhs->valU64;
-                            }
-                            else
-                            {
-                                result->valU64 = lhs->valU64 - rhs->valU64;
-                            }
-                        }
-                    }
-                    else if(head->valU64 == BB_TOKEN_OP_SUB)
-                    {
-                        if(lhs->kind == BB_VALUE_F64)
-                        {
-                            result->kind = BB_VALUE_F64;
-                            result->valF64 = -lhs->valF64;
-                        }
-                        else
-                        {
-                            result->kind = BB_VALUE_U64;
-                            result->valU64 = -lhs->valU64;
-                        }
-                    }
-                }
-            }
-        }
-        else
-        {
-            result->kind = BB_VALUE_LIST;
-            oc_list_for(cell->children, childCell, bb_cell, parentElt)
-            {
-                bb_value* childVal = bb_program_eval_pattern(arena, card, childCell, bindings);
-                oc_list_push_back(&result->children, &childVal->parentElt);
-            }
-        }
-    }
-    else if(cell->kind == BB_CELL_KEYWORD && cell->valU64 == BB_TOKEN_KW_SELF)
-    {
-        result->kind = BB_VALUE_CARD_ID;
-        result->valU64 = card->id;
-    }
-    else if(cell->kind == BB_CELL_FLOAT)
-    {
-        result->kind = BB_VALUE_F64;
-        result->valF64 = cell->valF64;
-    }
-    else if(cell->kind == BB_CELL_INT)
-    {
-        result->kind = BB_VALUE_U64;
-        result->valU64 = cell->valU64;
-    }
-    else if(cell->kind == BB_CELL_STRING)
-    {
-        result->kind = BB_VALUE_STRING;
-        result->string = oc_str8_push_copy(arena, cell->text);
-    }
-    else if(cell->kind == BB_CELL_PLACEHOLDER)
-    {
-        result->kind = BB_VALUE_PLACEHOLDER;
-        result->string = oc_str8_push_copy(arena, oc_str8_slice(cell->text, 1, cell->text.len));
-    }
-    else
-    {
-        bb_value* bound = bb_find_binding(bindings, cell->text);
-        if(bound)
-        {
-            *result = *bound;
-            result->parentElt = (oc_list_elt){ 0 };
-        }
-        else
-        {
-            result->kind = BB_VALUE_SYMBOL;
-            result->string = oc_str8_push_copy(arena, cell->text);
-        }
-    }
-
-    return (result);
-}
-
-bb_value* bb_program_match_pattern_against_value(oc_arena* arena, bb_value* value, bb_value* pattern, oc_list* bindings)
-{
-    bb_value* result = 0;
-    bool match = (value->kind == pattern->kind || pattern->kind == BB_VALUE_PLACEHOLDER);
-
-    if(match)
-    {
-        switch(pattern->kind)
-        {
-            case BB_VALUE_SYMBOL:
-            case BB_VALUE_STRING:
-                match = !oc_str8_cmp(value->string, pattern->string);
-                break;
-
-            case BB_VALUE_U64:
-            case BB_VALUE_CARD_ID:
-                match = (value->valU64 == pattern->valU64);
-                break;
-
-            case BB_VALUE_F64:
-                match = (value->valF64 == pattern->valF64);
-                break;
-
-            case BB_VALUE_LIST:
-            {
-                bb_value* childA = oc_list_first_entry(value->children, bb_value, parentElt);
-                bb_value* childB = oc_list_first_entry(pattern->children, bb_value, parentElt);
-                for(;
-                    childA != 0 && childB != 0;
-                    childA = oc_list_next_entry(childA, bb_value, parentElt),
-                    childB = oc_list_next_entry(childB, bb_value, parentElt))
-                {
-                    if(bb_program_match_pattern_against_value(arena, childA, childB, bindings) == 0)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if((childA == 0) != (childB == 0))
-                {
-                    match = false;
-                }
-            }
-            break;
-
-            case BB_VALUE_PLACEHOLDER:
-            {
-                bb_bound_val* binding = oc_arena_push_type(arena, bb_bound_val);
-                binding->name = pattern->string;
-                binding->value = value;
-                oc_list_push_back(bindings, &binding->listElt);
-            }
-            break;
-        }
-        if(match)
-        {
-            result = value;
-        }
-    }
-
-    return result;
-}
-
-typedef struct bb_match_result
-{
-    oc_list_elt listElt;
-    bb_fact* fact;
-    oc_list bindings;
-} bb_match_result;
-
-oc_list bb_program_match_pattern_against_facts(oc_arena* arena, bb_facts_db* factDb, bb_value* pattern)
-{
-    //NOTE: match pattern only against the facts in the db, not the builtin responders. This breaks a
-    // recursion cycle where responders need to add facts to the db, which first tries to find if the facts
-    // already exists, which would re-run the responders, etc...
-    // Hence bb_fact_db_push() needs to match new facts only against the existing facts, not responders.
-
-    oc_list results = { 0 };
-
-    oc_list_for(factDb->facts, fact, bb_fact, listElt)
-    {
-        oc_list bindings = { 0 };
-        bb_value* match = bb_program_match_pattern_against_value(arena, fact->root, pattern, &bindings);
-        if(match)
-        {
-            bb_match_result* result = oc_arena_push_type(arena, bb_match_result);
-
-            result->fact = fact;
-            result->bindings = bindings;
-            oc_list_push_back(&results, &result->listElt);
-        }
-    }
-    return results;
-}
-
-oc_list bb_program_match_pattern(oc_arena* arena, bb_facts_db* factDb, bb_value* pattern)
-{
-    //NOTE: returns a list of match results. Each contain the matched value, and associated bindings
-    oc_list results = { 0 };
-
-    //NOTE: run the pattern against responders
-    /*
-        e.g. we have a query (when self points up at $x), we want it to match the responder ($p points $dir at $q)
-
-        -> so we match the pattern of the _responder_ against the query, which returns the query with ($p = self, $dir = up, $q = $x),
-        and call the responder routine with this. It should check which pages self points up to, and return
-        (self points up at card-id) with ($x = card-id)
-    */
-    oc_list_for(factDb->responders, responder, bb_responder, listElt)
-    {
-        oc_list responderBindings = { 0 };
-        bb_value* match = bb_program_match_pattern_against_value(arena, pattern, responder->pattern, &responderBindings);
-        if(match)
-        {
-            oc_list answerBindings = { 0 };
-
-            bb_bindings bindings = { 0 };
-            bb_binding_scope scope = {
-                .bindings = responderBindings,
-            };
-            oc_list_push_front(&bindings.scopes, &scope.listElt);
-
-            responder->proc(arena, factDb, match, &bindings, &answerBindings);
-            /*
-            if(fact)
-            {
-                bb_match_result* result = oc_arena_push_type(arena, bb_match_result);
-                result->fact = fact;
-                result->bindings = answerBindings;
-                oc_list_push_back(&results, &result->listElt);
-            }
-            */
-        }
-    }
-
-    //NOTE: match againsts facts
-    results = bb_program_match_pattern_against_facts(arena, factDb, pattern);
-
-    return results;
-}
-
-void bb_program_interpret_cell(oc_arena* arena, bb_facts_db* factDb, bb_card* card, bb_cell* cell, bb_bindings* bindings)
-{
-    if(cell->kind == BB_CELL_LIST && !oc_list_empty(cell->children))
-    {
-        bb_cell* head = oc_list_first_entry(cell->children, bb_cell, parentElt);
-
-        if(head->kind == BB_CELL_KEYWORD)
-        {
-            if(head->valU64 == BB_TOKEN_KW_CLAIM)
-            {
-                oc_list list = { 0 };
-
-                for(bb_cell* child = oc_list_next_entry(head, bb_cell, parentElt);
-                    child != 0;
-                    child = oc_list_next_entry(child, bb_cell, parentElt))
-                {
-                    bb_value* val = bb_program_eval_pattern(arena, card, child, bindings);
-                    oc_list_push_back(&list, &val->parentElt);
-                }
-                bb_fact_db_push(arena, factDb, list);
-            }
-            else if(head->valU64 == BB_TOKEN_KW_WISH)
-            {
-                //NOTE: equivalent to  (claim self wishes ...)
-                //TODO: this leaks the two created nodes if the fact was already in the db...
-                oc_list list = { 0 };
-
-                bb_value* self = oc_arena_push_type(arena, bb_value);
-                memset(self, 0, sizeof(bb_value));
-                self->kind = BB_VALUE_CARD_ID;
-                self->valU64 = card->id;
-                oc_list_push_back(&list, &self->parentElt);
-
-                bb_value* wishes = oc_arena_push_type(arena, bb_value);
-                memset(wishes, 0, sizeof(bb_value));
-                wishes->kind = BB_VALUE_SYMBOL;
-                wishes->string = oc_str8_push_cstring(arena, "wishes");
-                oc_list_push_back(&list, &wishes->parentElt);
-
-                for(bb_cell* child = oc_list_next_entry(head, bb_cell, parentElt);
-                    child != 0;
-                    child = oc_list_next_entry(child, bb_cell, parentElt))
-                {
-                    bb_value* val = bb_program_eval_pattern(arena, card, child, bindings);
-                    oc_list_push_back(&list, &val->parentElt);
-                }
-
-                bb_fact_db_push(arena, factDb, list);
-            }
-            else if(head->valU64 == BB_TOKEN_KW_WHEN)
-            {
-                bb_cell* patternCell = oc_list_next_entry(head, bb_cell, parentElt);
-                if(patternCell)
-                {
-                    if(cell->lastFrame != factDb->frame)
-                    {
-                        //NOTE: reset lastRun if this is the first time we encounter the cell this frame
-                        cell->lastFrame = factDb->frame;
-                        cell->lastRun = 0;
-                    }
-
-                    bb_value* pattern = bb_program_eval_pattern(arena, card, patternCell, bindings);
-                    oc_list matches = bb_program_match_pattern(arena, factDb, pattern);
-
-                    //TODO: should still execute but only for new matches... ie facts that are younger than the last iteration we ran
-
-                    if(!oc_list_empty(matches))
-                    {
-                        oc_list_for(matches, match, bb_match_result, listElt)
-                        {
-                            for(bb_cell* child = oc_list_next_entry(patternCell, bb_cell, parentElt);
-                                child != 0;
-                                child = oc_list_next_entry(child, bb_cell, parentElt))
-                            {
-                                bb_binding_scope scope = {
-                                    .bindings = match->bindings,
-                                };
-                                oc_list_push_front(&bindings->scopes, &scope.listElt);
-                                bb_program_interpret_cell(arena, factDb, card, child, bindings);
-                                oc_list_pop_front(&bindings->scopes);
-                            }
-                        }
-                    }
-                    cell->lastRun = factDb->iteration;
-                }
-            }
-            else if(head->valU64 == BB_TOKEN_KW_VAR)
-            {
-                bb_cell* nameCell = oc_list_next_entry(head, bb_cell, parentElt);
-                if(nameCell && nameCell->kind == BB_CELL_SYMBOL)
-                {
-                    bb_bound_val* variable = 0;
-                    bool init = true;
-                    //check for existing var if top of stack
-                    bb_binding_scope* scope = oc_list_first_entry(bindings->scopes, bb_binding_scope, listElt);
-                    if(scope->listElt.next == 0)
-                    {
-                        oc_list_for(card->variables, var, bb_bound_val, cardElt)
-                        {
-                            if(!oc_str8_cmp(var->name, nameCell->text))
-                            {
-                                variable = var;
-                                init = false;
-                                break;
-                            }
-                        }
-                        if(!variable)
-                        {
-                            variable = oc_arena_push_type(&factDb->persistentArena, bb_bound_val);
-                            variable->name = oc_str8_push_copy(&factDb->persistentArena, nameCell->text);
-                            oc_list_push_back(&card->variables, &variable->cardElt);
-                            variable->value = &variable->storedValue;
-                            variable->value->kind = BB_VALUE_U64;
-                            variable->value->valU64 = 0;
-                        }
-                    }
-                    if(!variable)
-                    {
-                        variable = oc_arena_push_type(arena, bb_bound_val);
-                        variable->name = oc_str8_push_copy(arena, nameCell->text);
-                        variable->value = &variable->storedValue;
-                        variable->value->kind = BB_VALUE_U64;
-                        variable->value->valU64 = 0;
-                    }
-
-                    bb_cell* valCell = oc_list_next_entry(nameCell, bb_cell, parentElt);
-                    if(valCell && valCell->lastEdit == factDb->frame)
-                    {
-                        bb_value* val = bb_program_eval_pattern(arena, card, valCell, bindings);
-                        if(val->kind == BB_VALUE_U64 || val->kind == BB_VALUE_F64)
-                        {
-                            variable->storedValue = *val;
-                        }
-                        else if(val->kind == BB_VALUE_STRING)
-                        {
-                            //WARN: leak like there's no tomorrow
-                            variable->value->kind = BB_VALUE_STRING;
-                            variable->value->string = oc_str8_push_copy(&factDb->persistentArena, val->string);
-                        }
-                    }
-
-                    oc_list_push_back(&scope->bindings, &variable->listElt);
-                }
-            }
-            else if(head->valU64 == BB_TOKEN_KW_SET)
-            {
-                if(cell->lastFrame < factDb->frame)
-                {
-                    cell->lastFrame = factDb->frame;
-
-                    bb_cell* nameCell = oc_list_next_entry(head, bb_cell, parentElt);
-                    if(nameCell && nameCell->kind == BB_CELL_SYMBOL)
-                    {
-                        bb_cell* valCell = oc_list_next_entry(nameCell, bb_cell, parentElt);
-                        if(valCell)
-                        {
-                            bb_value* val = bb_program_eval_pattern(arena, card, valCell, bindings);
-
-                            bb_bound_val* var = bb_find_var(bindings, nameCell->text);
-                            if(var)
-                            {
-                                *var->value = *val;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    factDb->iteration++;
-}
-
-void bb_builtin_listener_label(bb_value* match, bb_bindings* bindings, bb_facts_db* factDb, oc_list cards)
-{
-    bb_value* p = bb_find_binding(bindings, OC_STR8("p"));
-    bb_value* q = bb_find_binding(bindings, OC_STR8("q"));
-    bb_value* s = bb_find_binding(bindings, OC_STR8("s"));
-
-    if(q && s && q->kind == BB_VALUE_CARD_ID)
-    {
-        oc_list_for(cards, card, bb_card, listElt)
-        {
-            if(card->id == q->valU64)
-            {
-                if(s->kind == BB_VALUE_STRING)
-                {
-                    card->label = s->string;
-                    card->labelFrame = factDb->frame;
-                }
-                else if(s->kind == BB_VALUE_U64)
-                {
-                    //WARN: leak 'til the sun explodes
-                    card->label = oc_str8_pushf(&factDb->persistentArena, "%lli", s->valU64);
-                    card->labelFrame = factDb->frame;
-                }
-                else if(s->kind == BB_VALUE_F64)
-                {
-                    //WARN: leak 'til the sun explodes
-                    card->label = oc_str8_pushf(&factDb->persistentArena, "%f", s->valF64);
-                    card->labelFrame = factDb->frame;
-                }
-            }
-        }
-    }
-}
-
-typedef struct bb_color_entry
-{
-    oc_str8 string;
-    oc_color color;
-} bb_color_entry;
-
-const bb_color_entry bb_highlight_colors[] = {
-    {
-        OC_STR8_LIT("red"),
-        { 1, 0, 0, 1 },
-    },
-    {
-        OC_STR8_LIT("green"),
-        { 0, 1, 0, 1 },
-    },
-    {
-        OC_STR8_LIT("blue"),
-        { 0, 0, 1, 1 },
-    },
-    {
-        OC_STR8_LIT("yellow"),
-        { 1, 1, 0, 1 },
-    },
-    {
-        OC_STR8_LIT("cyan"),
-        { 0, 1, 1, 1 },
-    },
-    {
-        OC_STR8_LIT("magenta"),
-        { 1, 0, 1, 1 },
-    },
-    {
-        OC_STR8_LIT("orange"),
-        { 1, 0.647, 0, 1, OC_COLOR_SPACE_SRGB },
-    },
-};
-const u32 bb_highlight_color_count = sizeof(bb_highlight_colors) / sizeof(bb_color_entry);
-
-void bb_builtin_listener_highlight(bb_value* match, bb_bindings* bindings, bb_facts_db* factDb, oc_list cards)
-{
-    bb_value* p = bb_find_binding(bindings, OC_STR8("p"));
-    bb_value* q = bb_find_binding(bindings, OC_STR8("q"));
-    bb_value* s = bb_find_binding(bindings, OC_STR8("s"));
-
-    if(q && s && q->kind == BB_VALUE_CARD_ID && s->kind == BB_VALUE_STRING)
-    {
-        oc_color color = { 0 };
-        bool found = false;
-        for(u32 i = 0; i < bb_highlight_color_count; i++)
-        {
-            if(!oc_str8_cmp(s->string, bb_highlight_colors[i].string))
-            {
-                color = bb_highlight_colors[i].color;
-                found = true;
-                break;
-            }
-        }
-
-        if(found)
-        {
-            oc_list_for(cards, card, bb_card, listElt)
-            {
-                if(card->id == q->valU64)
-                {
-                    card->highlight = color;
-                    card->highlightFrame = factDb->frame;
-                }
-            }
-        }
+
+    oc_list_for(cell->children, child, bb_cell, parentElt)
+    {
+        build_cell_ui(arena, editor, child, clip);
     }
 }
 
-void bb_program_init_builtin_listeners(oc_arena* arena, bb_facts_db* factDb)
+void bb_draw_cursor(bb_cell_editor* editor)
 {
-    {
-        bb_listener* listener = oc_arena_push_type(arena, bb_listener);
-
-        bb_value* pattern = oc_arena_push_type(arena, bb_value);
-        pattern->kind = BB_VALUE_LIST;
-
-        bb_value* p = oc_arena_push_type(arena, bb_value);
-        p->kind = BB_VALUE_PLACEHOLDER;
-        p->string = oc_str8_push_cstring(arena, "p");
-        oc_list_push_back(&pattern->children, &p->parentElt);
-
-        bb_value* wishes = oc_arena_push_type(arena, bb_value);
-        wishes->kind = BB_VALUE_SYMBOL;
-        wishes->string = oc_str8_push_cstring(arena, "wishes");
-        oc_list_push_back(&pattern->children, &wishes->parentElt);
-
-        bb_value* q = oc_arena_push_type(arena, bb_value);
-        q->kind = BB_VALUE_PLACEHOLDER;
-        q->string = oc_str8_push_cstring(arena, "q");
-        oc_list_push_back(&pattern->children, &q->parentElt);
+    oc_vec2 cursorPos = bb_point_to_display_pos(editor, editor->cursor);
 
-        bb_value* is = oc_arena_push_type(arena, bb_value);
-        is->kind = BB_VALUE_SYMBOL;
-        is->string = oc_str8_push_cstring(arena, "is");
-        oc_list_push_back(&pattern->children, &is->parentElt);
+    oc_set_color_rgba(0.95, 0.71, 0.25, 1);
+    oc_rectangle_fill(cursorPos.x - 2, cursorPos.y, 4, editor->lineHeight);
+}
 
-        bb_value* labeled = oc_arena_push_type(arena, bb_value);
-        labeled->kind = BB_VALUE_SYMBOL;
-        labeled->string = oc_str8_push_cstring(arena, "labeled");
-        oc_list_push_back(&pattern->children, &labeled->parentElt);
+void bb_draw_sibling_marker(bb_cell_editor* editor, bb_cell* cell, oc_color color)
+{
+    f32 lineHeight = editor->lineHeight;
 
-        bb_value* s = oc_arena_push_type(arena, bb_value);
-        s->kind = BB_VALUE_PLACEHOLDER;
-        s->string = oc_str8_push_cstring(arena, "s");
-        oc_list_push_back(&pattern->children, &s->parentElt);
+    oc_set_color(color);
+    oc_set_width(4);
+    oc_move_to(cell->rect.x, cell->rect.y + cell->rect.h - 2);
+    oc_line_to(cell->rect.x + cell->lastLineWidth, cell->rect.y + cell->rect.h - 2);
+    oc_stroke();
+}
 
-        listener->pattern = pattern;
-        listener->proc = bb_builtin_listener_label;
+void bb_draw_edit_range(bb_cell_editor* editor)
+{
+    f32 spaceWidth = editor->spaceWidth;
+    f32 lineHeight = editor->lineHeight;
 
-        oc_list_push_back(&factDb->listeners, &listener->listElt);
-    }
+    bb_point cursor = editor->cursor;
+    bb_point mark = editor->mark;
 
+    if(!bb_point_same_cell(cursor, mark))
     {
-        bb_listener* listener = oc_arena_push_type(arena, bb_listener);
-
-        bb_value* pattern = oc_arena_push_type(arena, bb_value);
-        pattern->kind = BB_VALUE_LIST;
+        //NOTE(martin): multiple nodes are selected, highlight the selection (in blue)
+        bb_cell_span span = bb_cell_span_from_points(cursor, mark);
+        bb_cell* parent = span.start->parent;
+        bb_cell* stop = bb_cell_next_sibling(span.end);
 
-        bb_value* p = oc_arena_push_type(arena, bb_value);
-        p->kind = BB_VALUE_PLACEHOLDER;
-        p->string = oc_str8_push_cstring(arena, "p");
-        oc_list_push_back(&pattern->children, &p->parentElt);
+        oc_rect startBox = bb_cell_frame_box(span.start);
+        oc_rect box = startBox;
+        oc_rect endBox = startBox;
 
-        bb_value* wishes = oc_arena_push_type(arena, bb_value);
-        wishes->kind = BB_VALUE_SYMBOL;
-        wishes->string = oc_str8_push_cstring(arena, "wishes");
-        oc_list_push_back(&pattern->children, &wishes->parentElt);
+        for(bb_cell* cell = span.start; cell != stop; cell = bb_cell_next_sibling(cell))
+        {
+            endBox = bb_cell_frame_box(cell);
+            box = bb_combined_box(box, endBox);
+        }
 
-        bb_value* q = oc_arena_push_type(arena, bb_value);
-        q->kind = BB_VALUE_PLACEHOLDER;
-        q->string = oc_str8_push_cstring(arena, "q");
-        oc_list_push_back(&pattern->children, &q->parentElt);
+        oc_rect firstLine = {
+            startBox.x,
+            startBox.y,
+            oc_max(0, box.x + box.w - startBox.x),
+            lineHeight,
+        };
 
-        bb_value* is = oc_arena_push_type(arena, bb_value);
-        is->kind = BB_VALUE_SYMBOL;
-        is->string = oc_str8_push_cstring(arena, "is");
-        oc_list_push_back(&pattern->children, &is->parentElt);
+        oc_rect innerSpan = {
+            box.x,
+            box.y + lineHeight,
+            box.w,
+            oc_max(0, box.h - 2 * lineHeight),
+        };
 
-        bb_value* labeled = oc_arena_push_type(arena, bb_value);
-        labeled->kind = BB_VALUE_SYMBOL;
-        labeled->string = oc_str8_push_cstring(arena, "highlighted");
-        oc_list_push_back(&pattern->children, &labeled->parentElt);
+        oc_rect lastLine = {
+            box.x,
+            box.y + box.h - lineHeight,
+            oc_max(0, endBox.x + endBox.w - box.x),
+            oc_max(0, endBox.y + endBox.h - (box.y + box.h - lineHeight)),
+        };
 
-        bb_value* s = oc_arena_push_type(arena, bb_value);
-        s->kind = BB_VALUE_PLACEHOLDER;
-        s->string = oc_str8_push_cstring(arena, "s");
-        oc_list_push_back(&pattern->children, &s->parentElt);
+        oc_set_color_rgba(0.2, 0.2, 1, 1);
 
-        listener->pattern = pattern;
-        listener->proc = bb_builtin_listener_highlight;
+        oc_rectangle_fill(firstLine.x, firstLine.y, firstLine.w, firstLine.h);
+        oc_rectangle_fill(innerSpan.x, innerSpan.y, innerSpan.w, innerSpan.h);
+        oc_rectangle_fill(lastLine.x, lastLine.y, lastLine.w, lastLine.h);
 
-        oc_list_push_back(&factDb->listeners, &listener->listElt);
+        bb_draw_cursor(editor);
     }
-}
-
-void bb_program_run_builtin_listeners(oc_arena* arena, bb_facts_db* factDb, oc_list cards)
-{
-    oc_list_for(factDb->listeners, listener, bb_listener, listElt)
+    else
     {
-        oc_list matches = bb_program_match_pattern(arena, factDb, listener->pattern);
-
-        oc_list_for(matches, match, bb_match_result, listElt)
-        {
-            if(match->fact->iteration > listener->lastRun)
-            {
-                bb_bindings bindings = { 0 };
-                bb_binding_scope scope = {
-                    .bindings = match->bindings,
-                };
-                oc_list_push_front(&bindings.scopes, &scope.listElt);
-
-                listener->proc(match->fact->root, &bindings, factDb, cards);
-            }
-        }
-        listener->lastRun = factDb->iteration;
-        factDb->iteration++;
-    }
-}
-
-oc_str8 bb_direction_strings[] = {
-    OC_STR8_LIT("up"),
-    OC_STR8_LIT("left"),
-    OC_STR8_LIT("down"),
-    OC_STR8_LIT("right"),
-};
-
-bb_fact* bb_builtin_responder_point(oc_arena* arena, bb_facts_db* factDb, bb_value* query, bb_bindings* queryBindings, oc_list* factBindings)
-{
-    bb_value* p = bb_find_binding(queryBindings, OC_STR8("p"));
-    bb_value* dir = bb_find_binding(queryBindings, OC_STR8("dir"));
-    bb_value* q = bb_find_binding(queryBindings, OC_STR8("q"));
+        //NOTE(martin): shade the parent cell of cursor/mark
+        oc_rect parentBox = bb_cell_contents_box(editor, cursor.parent);
+        oc_set_color_rgba(0.2, 0.2, 0.2, 1);
+        oc_rectangle_fill(parentBox.x, parentBox.y, parentBox.w, parentBox.h);
 
-    oc_list_for(factDb->cards, pointer, bb_card, listElt)
-    {
-        if(p->kind == BB_VALUE_PLACEHOLDER || (p->kind == BB_VALUE_CARD_ID && p->valU64 == pointer->id))
+        if(!cursor.leftFrom
+           && (bb_cell_has_text(cursor.parent))
+           && cursor.offset != mark.offset)
         {
-            for(u32 dirIndex = 0; dirIndex < BB_WHISKER_DIRECTION_COUNT; dirIndex++)
-            {
-                if(dir->kind == BB_VALUE_PLACEHOLDER
-                   || (dir->kind == BB_VALUE_SYMBOL && !oc_str8_cmp(dir->string, bb_direction_strings[dirIndex])))
-                {
-                    pointer->whiskerFrame[dirIndex] = factDb->frame;
+            //NOTE(martin): some text is selected. Highlight the selection (in blue).
+            oc_rect box = bb_cell_contents_box(editor, cursor.parent);
 
-                    oc_list_for(factDb->cards, pointee, bb_card, listElt)
-                    {
-                        if(q->kind == BB_VALUE_PLACEHOLDER || (q->kind == BB_VALUE_CARD_ID && q->valU64 == pointee->id))
-                        {
-                            oc_vec2 pCenter = {
-                                pointer->rect.x + pointer->rect.w / 2,
-                                pointer->rect.y + pointer->rect.h / 2,
-                            };
-                            oc_rect pRect = pointer->rect;
-                            oc_rect qRect = pointee->rect;
-
-                            bool test = false;
-                            switch(dirIndex)
-                            {
-                                case BB_WHISKER_DIRECTION_UP:
-                                    test = pCenter.x >= qRect.x
-                                        && pCenter.x <= (qRect.x + qRect.w)
-                                        && pRect.y - BB_WHISKER_SIZE >= qRect.y
-                                        && pRect.y - BB_WHISKER_SIZE <= (qRect.y + qRect.h);
-                                    break;
-                                case BB_WHISKER_DIRECTION_LEFT:
-                                    test = pCenter.y >= qRect.y
-                                        && pCenter.y <= (qRect.y + qRect.h)
-                                        && pRect.x - BB_WHISKER_SIZE >= qRect.x
-                                        && pRect.x - BB_WHISKER_SIZE <= (qRect.x + qRect.w);
-                                    break;
-                                case BB_WHISKER_DIRECTION_DOWN:
-                                    test = pCenter.x >= qRect.x
-                                        && pCenter.x <= (qRect.x + qRect.w)
-                                        && pRect.y + pRect.h + BB_WHISKER_SIZE >= qRect.y
-                                        && pRect.y + pRect.h + BB_WHISKER_SIZE <= (qRect.y + qRect.h);
-                                    break;
-                                case BB_WHISKER_DIRECTION_RIGHT:
-                                    test = pCenter.y >= qRect.y
-                                        && pCenter.y <= (qRect.y + qRect.h)
-                                        && pRect.x + pRect.w + BB_WHISKER_SIZE >= qRect.x
-                                        && pRect.x + pRect.w + BB_WHISKER_SIZE <= (qRect.x + qRect.w);
-                                    break;
-                            }
+            u64 start = oc_min(cursor.offset, mark.offset);
+            u64 end = oc_max(cursor.offset, mark.offset);
 
-                            if(test)
-                            {
-                                pointer->whiskerBoldFrame[dirIndex] = factDb->frame;
+            oc_str8 string = cursor.parent->text;
+            oc_rect leftBox = bb_text_metrics(editor, editor->fontSize, oc_str8_slice(string, 0, start)).logical;
+            oc_rect selBox = bb_text_metrics(editor, editor->fontSize, oc_str8_slice(string, start, end)).logical;
 
-                                //NOTE add a fact to the database, which will be picked up next iteration...
-                                oc_list list = { 0 };
+            selBox.x += box.x + leftBox.w;
+            selBox.y = box.y;
 
-                                bb_value* pVal = oc_arena_push_type(arena, bb_value);
-                                pVal->kind = BB_VALUE_CARD_ID;
-                                pVal->valU64 = pointer->id;
-                                oc_list_push_back(&list, &pVal->parentElt);
+            oc_set_color_rgba(0.2, 0.2, 1, 1);
+            oc_rectangle_fill(selBox.x, selBox.y, selBox.w, selBox.h);
 
-                                bb_value* pointsVal = oc_arena_push_type(arena, bb_value);
-                                pointsVal->kind = BB_VALUE_SYMBOL;
-                                pointsVal->string = OC_STR8("points");
-                                oc_list_push_back(&list, &pointsVal->parentElt);
+            //  editor->animatedCursor = bb_point_to_display_pos(editor, editor->cursor);
+        }
+        else
+        {
+            bb_draw_cursor(editor);
+        }
+    }
+    //NOTE(martin): underline cells to the left/right of cursor
+    bb_cell* leftSibling = bb_point_left_cell(cursor);
+    bb_cell* rightSibling = bb_point_right_cell(cursor);
 
-                                bb_value* dirVal = oc_arena_push_type(arena, bb_value);
-                                dirVal->kind = BB_VALUE_SYMBOL;
-                                dirVal->string = bb_direction_strings[dirIndex];
-                                oc_list_push_back(&list, &dirVal->parentElt);
+    if(leftSibling)
+    {
+        bb_draw_sibling_marker(editor, leftSibling, (oc_color){ 0.2, 0.5, 1, 1 });
+    }
+    if(rightSibling)
+    {
+        bb_draw_sibling_marker(editor, rightSibling, (oc_color){ 0, 1, 0, 1 });
+    }
+}
 
-                                bb_value* atVal = oc_arena_push_type(arena, bb_value);
-                                atVal->kind = BB_VALUE_SYMBOL;
-                                atVal->string = OC_STR8("at");
-                                oc_list_push_back(&list, &atVal->parentElt);
+void bb_editor_draw_proc(oc_ui_box* box, void* data)
+{
+    bb_cell_editor* editor = (bb_cell_editor*)data;
 
-                                bb_value* qVal = oc_arena_push_type(arena, bb_value);
-                                qVal->kind = BB_VALUE_CARD_ID;
-                                qVal->valU64 = pointee->id;
-                                oc_list_push_back(&list, &qVal->parentElt);
+    oc_matrix_push((oc_mat2x3){
+        1, 0, box->rect.x,
+        0, 1, box->rect.y });
 
-                                bb_fact_db_push(arena, factDb, list);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return 0;
+    bb_draw_edit_range(editor);
+    oc_matrix_pop();
 }
 
-bb_fact* bb_builtin_responder_clicked(oc_arena* arena, bb_facts_db* factDb, bb_value* query, bb_bindings* queryBindings, oc_list* factBindings)
+void bb_card_draw_cells(oc_arena* frameArena, bb_cell_editor* editor, bb_card* card, oc_rect viewport)
 {
-    bb_value* p = bb_find_binding(queryBindings, OC_STR8("p"));
-
-    oc_list_for(factDb->cards, card, bb_card, listElt)
+    oc_ui_box* box = oc_ui_container("cells", OC_UI_FLAG_DRAW_PROC)
     {
-        if(p->kind == BB_VALUE_PLACEHOLDER || (p->kind == BB_VALUE_CARD_ID && p->valU64 == card->id))
+        if(card->root)
         {
-            if(card->clickedFrame == factDb->frame)
-            {
-                oc_list list = { 0 };
-
-                bb_value* pVal = oc_arena_push_type(arena, bb_value);
-                pVal->kind = BB_VALUE_CARD_ID;
-                pVal->valU64 = card->id;
-                oc_list_push_back(&list, &pVal->parentElt);
-
-                bb_value* isVal = oc_arena_push_type(arena, bb_value);
-                isVal->kind = BB_VALUE_SYMBOL;
-                isVal->string = OC_STR8("is");
-                oc_list_push_back(&list, &isVal->parentElt);
-
-                bb_value* clickedVal = oc_arena_push_type(arena, bb_value);
-                clickedVal->kind = BB_VALUE_SYMBOL;
-                clickedVal->string = OC_STR8("clicked");
-                oc_list_push_back(&list, &clickedVal->parentElt);
+            cell_update_layout(editor, card->root, (oc_vec2){ 10, 20 });
+            cell_update_rects(editor, card->root, (oc_vec2){ 0 });
 
-                bb_fact_db_push(arena, factDb, list);
+            //NOTE: only build the boxes of cells that are visible, ie. that intersect the card clipped by the
+            //      viewport. The viewport is given in the same coordinates as the card's displayRect, and both
+            //      are the ones of the current frame, as are cell rects. Only the offset of the cells box in the
+            //      card box comes from the last frame, so cards that were not laid out yet don't cull anything.
+            oc_rect* clip = 0;
+            oc_rect clipRect = { 0 };
+            oc_ui_box* cardBox = box->parent;
+            if(cardBox && cardBox->rect.w > 0 && cardBox->rect.h > 0)
+            {
+                oc_rect cardRect = card->displayRect;
+                f32 x0 = oc_max(viewport.x, cardRect.x);
+                f32 y0 = oc_max(viewport.y, cardRect.y);
+                f32 x1 = oc_min(viewport.x + viewport.w, cardRect.x + cardRect.w);
+                f32 y1 = oc_min(viewport.y + viewport.h, cardRect.y + cardRect.h);
+
+                //NOTE: cell rects are relative to the cells box
+                oc_vec2 cellsOrigin = {
+                    cardRect.x + box->rect.x - cardBox->rect.x,
+                    cardRect.y + box->rect.y - cardBox->rect.y,
+                };
+                clipRect = (oc_rect){ x0 - cellsOrigin.x, y0 - cellsOrigin.y, x1 - x0, y1 - y0 };
+                clip = &clipRect;
             }
+            build_cell_ui(frameArena, editor, card->root, clip);
         }
     }
-    return 0;
-}
 
-void bb_program_init_builtin_responders(oc_arena* arena, bb_facts_db* factDb)
-{
+    if(editor->editedCard == card)
     {
-        bb_responder* responder = oc_arena_push_type(arena, bb_responder);
-
-        bb_value* pattern = oc_arena_push_type(arena, bb_value);
-        pattern->kind = BB_VALUE_LIST;
-
-        bb_value* p = oc_arena_push_type(arena, bb_value);
-        p->kind = BB_VALUE_PLACEHOLDER;
-        p->string = oc_str8_push_cstring(arena, "p");
-        oc_list_push_back(&pattern->children, &p->parentElt);
-
-        bb_value* points = oc_arena_push_type(arena, bb_value);
-        points->kind = BB_VALUE_SYMBOL;
-        points->string = oc_str8_push_cstring(arena, "points");
-        oc_list_push_back(&pattern->children, &points->parentElt);
-
-        bb_value* direction = oc_arena_push_type(arena, bb_value);
-        direction->kind = BB_VALUE_PLACEHOLDER;
-        direction->string = oc_str8_push_cstring(arena, "dir");
-        oc_list_push_back(&pattern->children, &direction->parentElt);
-
-        bb_value* at = oc_arena_push_type(arena, bb_value);
-        at->kind = BB_VALUE_SYMBOL;
-        at->string = oc_str8_push_cstring(arena, "at");
-        oc_list_push_back(&pattern->children, &at->parentElt);
-
-        bb_value* q = oc_arena_push_type(arena, bb_value);
-        q->kind = BB_VALUE_PLACEHOLDER;
-        q->string = oc_str8_push_cstring(arena, "q");
-        oc_list_push_back(&pattern->children, &q->parentElt);
-
-        responder->pattern = pattern;
-        responder->proc = bb_builtin_responder_point;
-
-        oc_list_push_back(&factDb->responders, &responder->listElt);
+        oc_ui_box_set_draw_proc(box, bb_editor_draw_proc, editor);
     }
-
+    else
     {
-        bb_responder* responder = oc_arena_push_type(arena, bb_responder);
-
-        bb_value* pattern = oc_arena_push_type(arena, bb_value);
-        pattern->kind = BB_VALUE_LIST;
+        oc_ui_box_set_draw_proc(box, 0, editor);
+    }
+}
 
-        bb_value* p = oc_arena_push_type(arena, bb_value);
-        p->kind = BB_VALUE_PLACEHOLDER;
-        p->string = oc_str8_push_cstring(arena, "p");
-        oc_list_push_back(&pattern->children, &p->parentElt);
+typedef struct bb_thumbnail_draw_proc_data
+{
+    bb_cell_editor* editor;
+    bb_thumbnail* thumbnail;
+} bb_thumbnail_draw_proc_data;
 
-        bb_value* is = oc_arena_push_type(arena, bb_value);
-        is->kind = BB_VALUE_SYMBOL;
-        is->string = oc_str8_push_cstring(arena, "is");
-        oc_list_push_back(&pattern->children, &is->parentElt);
+void bb_thumbnail_collect_cells(bb_thumbnail* thumbnail, bb_cell* cell, oc_rect clip)
+{
+    if(thumbnail->cellCount >= BB_THUMBNAIL_MAX_CELL_COUNT
+       || cell->rect.x >= clip.x + clip.w
+       || cell->rect.y >= clip.y + clip.h
+       || cell->rect.x + cell->rect.w <= clip.x
+       || cell->rect.y + cell->rect.h <= clip.y)
+    {
+        return;
+    }
+    thumbnail->cells[thumbnail->cellCount] = cell;
+    thumbnail->cellCount++;
 
-        bb_value* clicked = oc_arena_push_type(arena, bb_value);
-        clicked->kind = BB_VALUE_SYMBOL;
-        clicked->string = oc_str8_push_cstring(arena, "clicked");
-        oc_list_push_back(&pattern->children, &clicked->parentElt);
+    oc_list_for(cell->children, child, bb_cell, parentElt)
+    {
+        bb_thumbnail_collect_cells(thumbnail, child, clip);
+    }
+}
 
-        responder->pattern = pattern;
-        responder->proc = bb_builtin_responder_clicked;
+void bb_thumbnail_draw_proc(oc_ui_box* box, void* user)
+{
+    bb_thumbnail_draw_proc_data* data = (bb_thumbnail_draw_proc_data*)user;
+    bb_thumbnail* thumbnail = data->thumbnail;
 
-        oc_list_push_back(&factDb->responders, &responder->listElt);
+    for(u32 i = 0; i < thumbnail->cellCount; i++)
+    {
+        bb_cell* cell = thumbnail->cells[i];
+        oc_rect rect = {
+            box->rect.x + cell->rect.x,
+            box->rect.y + cell->rect.y,
+            cell->rect.w,
+            cell->rect.h,
+        };
+        bb_cell_draw(data->editor, cell, rect);
     }
 }
 
-typedef struct bb_program_stats
+void bb_card_release_thumbnail(bb_cell_editor* editor, bb_card* card)
 {
-    u64 frame;
-    u64 iterations;
-    f64 duration;
-} bb_program_stats;
+    if(card->thumbnail)
+    {
+        oc_list_remove(&editor->thumbnails, &card->thumbnail->listElt);
+        oc_pool_recycle(&editor->thumbnailPool, card->thumbnail);
+        editor->thumbnailCount--;
+        card->thumbnail = 0;
+    }
+}
 
-bb_program_stats bb_program_update(oc_arena* frameArena, bb_facts_db* factDb, oc_list cards)
+void bb_card_draw_thumbnail(oc_arena* frameArena, bb_cell_editor* editor, bb_card* card)
 {
-    factDb->facts = (oc_list){ 0 };
-    factDb->factCount = 0;
-    factDb->iteration = 1;
-    factDb->cards = cards;
-
-    //NOTE: reset built-in listeners last run
-    oc_list_for(factDb->listeners, listener, bb_listener, listElt)
+    oc_ui_box* box = oc_ui_container("cells", OC_UI_FLAG_DRAW_PROC)
     {
-        listener->lastRun = 0;
     }
 
-    //NOTE: run until fixed point (i.e. until iteration doesn't generate any new facts)
-    u32 itCount = 0;
-    u32 prevFactCount = 0;
-
-    f64 start = oc_clock_time(OC_CLOCK_MONOTONIC);
-    do
+    bb_thumbnail* thumbnail = card->thumbnail;
+    if(!thumbnail)
     {
-        prevFactCount = factDb->factCount;
-
-        oc_list_for(cards, card, bb_card, listElt)
+        if(editor->thumbnailCount >= BB_THUMBNAIL_MAX_COUNT)
         {
-            bb_bindings bindings = { 0 };
-            bb_binding_scope scope = { 0 };
-            oc_list_push_front(&bindings.scopes, &scope.listElt);
-
-            oc_list_for(card->root->children, cell, bb_cell, parentElt)
-            {
-                bb_program_interpret_cell(frameArena, factDb, card, cell, &bindings);
-            }
+            bb_thumbnail* last = oc_list_last_entry(editor->thumbnails, bb_thumbnail, listElt);
+            bb_card_release_thumbnail(editor, last->card);
         }
-
-        bb_program_run_builtin_listeners(frameArena, factDb, cards);
-
-        itCount++;
+        thumbnail = oc_pool_alloc_type(&editor->thumbnailPool, bb_thumbnail);
+        memset(thumbnail, 0, sizeof(bb_thumbnail));
+        thumbnail->card = card;
+        card->thumbnail = thumbnail;
+        editor->thumbnailCount++;
     }
-    while(prevFactCount != factDb->factCount);
-
-    f32 duration = oc_clock_time(OC_CLOCK_MONOTONIC) - start;
+    else
+    {
+        oc_list_remove(&editor->thumbnails, &thumbnail->listElt);
+    }
+    oc_list_push_front(&editor->thumbnails, &thumbnail->listElt);
 
-    //    bb_debug_print_facts(factDb);
-    //printf("Fix point reached in %u iterations and %f seconds\n", itCount, duration);
+    //NOTE: the cells are collected again when the card has been edited since the last time, since edits can
+    //      recycle the collected cells. Cells are laid out from the origin of the cells box, which is inside the
+    //      card's box, so the cells that fit in the card's size include all the visible ones.
+    if(!thumbnail->frame || !card->root || card->root->lastEdit >= thumbnail->frame)
+    {
+        thumbnail->cellCount = 0;
+        if(card->root)
+        {
+            cell_update_layout(editor, card->root, (oc_vec2){ 10, 20 });
+            cell_update_rects(editor, card->root, (oc_vec2){ 0 });
 
-    factDb->frame++;
+            oc_rect clip = { 0, 0, card->displayRect.w, card->displayRect.h };
+            bb_thumbnail_collect_cells(thumbnail, card->root, clip);
+        }
+        thumbnail->frame = editor->frame;
+    }
 
-    return ((bb_program_stats){
-        .frame = factDb->frame - 1,
-        .iterations = itCount,
-        .duration = duration,
-    });
+    bb_thumbnail_draw_proc_data* data = oc_arena_push_type(frameArena, bb_thumbnail_draw_proc_data);
+    data->editor = editor;
+    data->thumbnail = thumbnail;
+    oc_ui_box_set_draw_proc(box, bb_thumbnail_draw_proc, data);
 }
 
 //------------------------------------------------------------------------------------------------
@@ -3277,7 +2121,7 @@ void bb_card_draw_proc(oc_ui_box* box, void* user)
     if(data->card->labelFrame == data->frame - 1)
     {
         oc_font_metrics fontMetrics = oc_font_get_metrics(data->editor->font, fontSize);
-        oc_text_metrics metrics = oc_font_text_metrics(data->editor->font, fontSize, data->card->label);
+        oc_text_metrics metrics = bb_text_metrics(data->editor, fontSize, data->card->label);
         f32 x = rect.x + (rect.w - metrics.logical.w) / 2;
         f32 y = rect.y + (rect.h - metrics.logical.h) / 2 + fontMetrics.ascent;
 
@@ -3285,7 +2129,7 @@ void bb_card_draw_proc(oc_ui_box* box, void* user)
         oc_set_font(data->editor->font);
         oc_set_font_size(fontSize);
         oc_set_color_rgba(1, 1, 1, 0.5);
-        oc_text_outlines(data->card->label);
+        bb_text_outlines(data->editor, fontSize, data->card->label);
         oc_fill();
     }
     if(data->card->highlightFrame == data->frame - 1)
@@ -3406,6 +2250,11 @@ int main()
     f64 frameTime = 0;
 
     oc_list InactiveList = { 0 };
+    u32 inactiveCount = 0;
+    //NOTE: last inactive card found by the left panel, so that the first visible card can be reached from
+    //      there rather than from the head of the list. It's reset whenever InactiveList is modified.
+    bb_card* inactiveCursor = 0;
+    u32 inactiveCursorIndex = 0;
     oc_list backgroundList = { 0 };
     oc_list activeList = { 0 };
 
@@ -3452,6 +2301,7 @@ int main()
     oc_list_push_back(&InactiveList, &cards[0].listElt);
     oc_list_push_back(&InactiveList, &cards[1].listElt);
     oc_list_push_back(&InactiveList, &cards[2].listElt);
+    inactiveCount = 3;
 
     oc_list_push_back(&backgroundList, &cards[3].listElt);
     oc_list_push_back(&backgroundList, &cards[4].listElt);
@@ -3475,6 +2325,7 @@ int main()
     };
 
     oc_arena_init(&editor.arena);
+    bb_cell_editor_init_pools(&editor);
 
     for(int i = 0; i < 8; i++)
     {
@@ -3484,7 +2335,7 @@ int main()
         cards[i].root->kind = BB_CELL_LIST;
     }
 
-    bb_facts_db factDb = { .frame = 2 };
+    bb_facts_db factDb = { .frame = 2, .incremental = true };
 
     oc_arena_init(&factDb.persistentArena);
 
@@ -3516,6 +2367,7 @@ int main()
                     if(event->key.action == OC_KEY_PRESS && event->key.keyCode == OC_KEY_D && (event->key.mods & OC_KEYMOD_CMD))
                     {
                         showDatabase = !showDatabase;
+                        factDb.profiling = showDatabase;
                     }
                 }
                 break;
@@ -3684,7 +2536,8 @@ int main()
                     {
                         oc_list_for(activeList, card, bb_card, listElt)
                         {
-                            oc_str8 key = oc_str8_pushf(scratch.arena, "card-%u", card->id);
+                            char keyBuffer[BB_UI_KEY_MAX_SIZE];
+                            oc_str8 key = bb_ui_key(keyBuffer, "card-", card->id);
 
                             oc_ui_box* box = oc_ui_box_lookup_str8(key);
 
@@ -3810,7 +2663,10 @@ int main()
                                                          | OC_UI_FLAG_DRAW_PROC)
                                 {
                                     oc_ui_label_str8(key);
-                                    bb_card_draw_cells(scratch.arena, &editor, card);
+                                    bb_card_draw_cells(scratch.arena,
+                                                       &editor,
+                                                       card,
+                                                       (oc_rect){ canvas->scroll.x, canvas->scroll.y, canvas->rect.w, canvas->rect.h });
                                 }
                             }
                         }
@@ -3875,23 +2731,87 @@ int main()
                                 placeholderIndex = (int)(y / (spacing + thumbnailSize));
                             }
 
-                            i32 index = 0;
+                            //NOTE: entries have a fixed stride, so the range of entries within the scroll window of
+                            //      the last frame, plus a few rows of margin, is computed from the scroll offset.
+                            //      Only these entries are visited, the other ones are left untouched.
+                            const f32 stride = thumbnailSize + spacing;
+                            bool hasPlaceholder = (placeholderIndex >= 0 && placeholderIndex < (i32)inactiveCount);
+                            u32 entryCount = inactiveCount + (hasPlaceholder ? 1 : 0);
+
+                            f32 windowHeight = leftPanelScroll->rect.h > 0 ? leftPanelScroll->rect.h : frameSize.y;
+                            f32 windowMargin = 2 * stride;
+                            f32 windowTop = leftPanelScroll->scroll.y - windowMargin;
+                            f32 windowBottom = leftPanelScroll->scroll.y + windowHeight + windowMargin;
+
+                            i32 firstSlot = (i32)(oc_max(0, windowTop - margin) / stride);
+                            i32 lastSlot = (i32)(oc_max(0, windowBottom - margin) / stride);
+
+                            //NOTE: slots after the placeholder hold the entry before them
+                            i32 firstIndex = (hasPlaceholder && firstSlot > placeholderIndex) ? firstSlot - 1 : firstSlot;
+                            i32 lastIndex = (hasPlaceholder && lastSlot > placeholderIndex) ? lastSlot - 1 : lastSlot;
+                            lastIndex = oc_min(lastIndex, (i32)inactiveCount - 1);
+
+                            if(hasPlaceholder)
+                            {
+                                //NOTE: the card after the placeholder is always visited, so that insertBefore is found
+                                firstIndex = oc_min(firstIndex, placeholderIndex);
+                                lastIndex = oc_max(lastIndex, placeholderIndex);
+                            }
+
+                            bb_card* card = 0;
+                            if(firstIndex <= lastIndex)
+                            {
+                                card = inactiveCursor;
+                                i32 index = inactiveCursorIndex;
+                                if(!card)
+                                {
+                                    card = oc_list_first_entry(InactiveList, bb_card, listElt);
+                                    index = 0;
+                                }
+                                while(index < firstIndex)
+                                {
+                                    card = oc_list_next_entry(card, bb_card, listElt);
+                                    index++;
+                                }
+                                while(index > firstIndex)
+                                {
+                                    card = oc_list_prev_entry(card, bb_card, listElt);
+                                    index--;
+                                }
+                                inactiveCursor = card;
+                                inactiveCursorIndex = firstIndex;
+                            }
+
                             f32 x = (SIDE_PANEL_WIDTH - thumbnailSize) / 2;
-                            f32 y = margin;
-                            oc_list_for_safe(InactiveList, card, bb_card, listElt)
+                            for(i32 index = firstIndex; card && index <= lastIndex; index++)
                             {
+                                bb_card* next = oc_list_next_entry(card, bb_card, listElt);
+
+                                i32 slot = (hasPlaceholder && index >= placeholderIndex) ? index + 1 : index;
+                                f32 y = margin + slot * stride;
+
                                 if(index == placeholderIndex)
                                 {
                                     insertBefore = &card->listElt;
-                                    y += thumbnailSize + spacing;
                                 }
 
-                                card->displayRect.x += cardAnimationTimeConstant * (x - card->displayRect.x);
-                                card->displayRect.y += cardAnimationTimeConstant * (y - card->displayRect.y);
-                                card->displayRect.w = 100;
-                                card->displayRect.h = 100;
+                                //NOTE: entries that were out of the window last frame are snapped to their slot, so that
+                                //      they don't slide in from where they were when they were last visible
+                                if(card->panelFrame + 1 != editor.frame)
+                                {
+                                    card->displayRect = (oc_rect){ x, y, thumbnailSize, thumbnailSize };
+                                }
+                                else
+                                {
+                                    card->displayRect.x += cardAnimationTimeConstant * (x - card->displayRect.x);
+                                    card->displayRect.y += cardAnimationTimeConstant * (y - card->displayRect.y);
+                                    card->displayRect.w = 100;
+                                    card->displayRect.h = 100;
+                                }
+                                card->panelFrame = editor.frame;
 
-                                oc_str8 key = oc_str8_pushf(scratch.arena, "card-%u", card->id);
+                                char keyBuffer[BB_UI_KEY_MAX_SIZE];
+                                oc_str8 key = bb_ui_key(keyBuffer, "card-", card->id);
 
                                 oc_ui_style_next(&(oc_ui_style){
                                                      .size = {
@@ -3914,7 +2834,7 @@ int main()
                                 oc_ui_box* box = oc_ui_container_str8(key, OC_UI_FLAG_CLIP | OC_UI_FLAG_DRAW_BACKGROUND | OC_UI_FLAG_CLICKABLE)
                                 {
                                     oc_ui_label_str8(key);
-                                    bb_card_draw_cells(scratch.arena, &editor, card);
+                                    bb_card_draw_thumbnail(scratch.arena, &editor, card);
                                 }
 
                                 oc_ui_sig sig = oc_ui_box_sig(box);
@@ -3926,12 +2846,28 @@ int main()
                                     card->rect.y = mousePos.y - sig.mouse.y;
                                     oc_list_remove(&InactiveList, &card->listElt);
                                     oc_list_push_back(&activeList, &card->listElt);
+                                    bb_card_release_thumbnail(&editor, card);
+                                    inactiveCount--;
+                                    inactiveCursor = 0;
 
                                     dragging = card;
                                 }
 
-                                y += thumbnailSize + spacing;
-                                index++;
+                                card = next;
+                            }
+
+                            //NOTE: the thumbnails are floating, so the contents are given the height of the whole list
+                            //      by a spacer, which keeps the scroll range when entries are not built.
+                            if(entryCount)
+                            {
+                                oc_ui_style_next(&(oc_ui_style){
+                                                     .size = {
+                                                         .width = { OC_UI_SIZE_PIXELS, thumbnailSize },
+                                                         .height = { OC_UI_SIZE_PIXELS, entryCount * stride - spacing },
+                                                     },
+                                                 },
+                                                 OC_UI_STYLE_SIZE);
+                                oc_ui_box_make_str8(OC_STR8("spacer"), 0);
                             }
                         }
                     }
@@ -3985,7 +2921,8 @@ int main()
                                      },
                                      OC_UI_STYLE_SIZE | OC_UI_STYLE_FLOAT | OC_UI_STYLE_BG_COLOR | OC_UI_STYLE_BORDER_COLOR | OC_UI_STYLE_BORDER_SIZE | OC_UI_STYLE_ROUNDNESS | OC_UI_STYLE_LAYOUT_MARGINS);
 
-                    oc_str8 key = oc_str8_pushf(scratch.arena, "card-%u", dragging->id);
+                    char keyBuffer[BB_UI_KEY_MAX_SIZE];
+                    oc_str8 key = bb_ui_key(keyBuffer, "card-", dragging->id);
 
                     oc_ui_container_str8(key,
                                          OC_UI_FLAG_CLIP
@@ -3995,7 +2932,7 @@ int main()
                                              | OC_UI_FLAG_BLOCK_MOUSE)
                     {
                         oc_ui_label_str8(key);
-                        bb_card_draw_cells(scratch.arena, &editor, dragging);
+                        bb_card_draw_cells(scratch.arena, &editor, dragging, (oc_rect){ 0, 0, frameSize.x, frameSize.y });
                     }
                 }
 
@@ -4015,6 +2952,13 @@ int main()
                         {
                             oc_list_insert_before(&InactiveList, insertBefore, &dragging->listElt);
                         }
+                        inactiveCount++;
+                        inactiveCursor = 0;
+
+                        //NOTE: the dropped card animates from the drop position to its slot
+                        dragging->displayRect.x = dragging->rect.x;
+                        dragging->displayRect.y = dragging->rect.y;
+                        dragging->panelFrame = editor.frame;
                     }
                     else
                     {
@@ -4056,7 +3000,8 @@ int main()
                                          },
                                          OC_UI_STYLE_SIZE | OC_UI_STYLE_FLOAT);
 
-                        oc_str8 illumKey = oc_str8_pushf(scratch.arena, "illum-%llu", card->id);
+                        char keyBuffer[BB_UI_KEY_MAX_SIZE];
+                        oc_str8 illumKey = bb_ui_key(keyBuffer, "illum-", card->id);
                         oc_ui_box* box = oc_ui_box_make_str8(illumKey, OC_UI_FLAG_DRAW_PROC);
 
                         bb_card_draw_proc_data* data = oc_arena_push_type(scratch.arena, bb_card_draw_proc_data);
@@ -4083,15 +3028,56 @@ int main()
             oc_set_color_rgba(1, 1, 1, 1);
 
             oc_str8 str = oc_str8_pushf(scratch.arena,
-                                        "Frame: %llu, reached fixed point in %llu iteration%s / %.3f ms.",
+                                        "Frame: %" PRIu64 ", reached fixed point in %" PRIu64 " iteration%s / %.3f ms, scanned %" PRIu64 " facts (skipped %" PRIu64 "), retracted %" PRIu64 " facts, evaluated %" PRIu64 " cards.",
                                         stats.frame,
                                         stats.iterations,
                                         stats.iterations > 1 ? "s" : "",
-                                        stats.duration * 1000.);
+                                        stats.duration * 1000.,
+                                        stats.factsScanned,
+                                        stats.factsSkipped,
+                                        stats.factsRetracted,
+                                        stats.cardsEvaluated);
+            oc_text_outlines(str);
+            pos.y += editor.lineHeight;
+            oc_move_to(pos.x, pos.y);
+
+            str = oc_str8_pushf(scratch.arena,
+                                "Cells: %" PRIu64 " live, %" PRIu64 " free.",
+                                editor.liveCellCount,
+                                editor.freeCellCount);
             oc_text_outlines(str);
             pos.y += editor.lineHeight;
             oc_move_to(pos.x, pos.y);
 
+            //NOTE: show the most expensive cards and whens of the last update
+            bb_profile_list profiles = bb_program_collect_profiles(scratch.arena, &factDb, activeList, false);
+            if(profiles.count)
+            {
+                oc_text_outlines(OC_STR8("Rules:\n"));
+
+                pos.y += editor.lineHeight;
+                oc_move_to(pos.x, pos.y);
+
+                for(u32 i = 0; i < oc_min(profiles.count, 10); i++)
+                {
+                    bb_profile_entry* entry = &profiles.entries[i];
+                    bb_profile_counters* counters = &entry->profile->last;
+
+                    str = oc_str8_pushf(scratch.arena,
+                                        "  %.3f ms, evaluated %" PRIu64 " times, scanned %" PRIu64 " facts, %" PRIu64 " matches, produced %" PRIu64 " facts:    %.*s",
+                                        counters->nanoseconds / 1e6,
+                                        counters->evaluations,
+                                        counters->factsScanned,
+                                        counters->matches,
+                                        counters->factsProduced,
+                                        oc_str8_ip(bb_profile_entry_label(scratch.arena, entry)));
+                    oc_text_outlines(str);
+
+                    pos.y += editor.lineHeight;
+                    oc_move_to(pos.x, pos.y);
+                }
+            }
+
             if(!oc_list_empty(factDb.facts))
             {
                 oc_text_outlines(OC_STR8("Facts:\n"));
@@ -4129,6 +3115,7 @@ int main()
         oc_scratch_end(scratch);
     }
 
+    bb_fact_db_cleanup(&factDb);
     oc_terminate();
 
     return (0);
@@ -0,0 +1,258 @@
+/*************************************************************************
+*
+*  HMNJam24
+*  Copyright 2024 Martin Fouilleul
+*
+**************************************************************************/
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+//NOTE: headless program runner. Each file given on the command line holds the program of one card, written as
+//      a sequence of s-expressions. Cards are laid out on a grid and the program is run for a number of frames
+//      without a window, printing the stats of each frame and the facts of the last one.
+
+enum
+{
+    BB_RUNNER_CARD_SIZE = 200,
+    BB_RUNNER_CARD_SPACING = 250,
+    BB_RUNNER_MOVE_STEP = 10,
+};
+
+bb_cell* bb_runner_load_card_program(oc_arena* arena, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(!file)
+    {
+        oc_log_error("Could not open card program '%s': %s\n", path, strerror(errno));
+        return (0);
+    }
+    fseek(file, 0, SEEK_END);
+    u64 size = ftell(file);
+    rewind(file);
+
+    oc_arena_scope scratch = oc_scratch_begin();
+    char* buffer = oc_arena_push(scratch.arena, size);
+    fread(buffer, 1, size, file);
+    fclose(file);
+
+    bb_cell* root = bb_read_program(arena, oc_str8_from_buffer(size, buffer));
+    if(!root)
+    {
+        oc_log_error("Could not read card program '%s'\n", path);
+    }
+    oc_scratch_end(scratch);
+    return (root);
+}
+
+bool bb_runner_write_profiles(const char* path, bb_facts_db* factDb, oc_list cards)
+{
+    //NOTE: writes the profiles of cards and whens accumulated over all frames, as csv
+    FILE* file = fopen(path, "w");
+    if(!file)
+    {
+        oc_log_error("Could not open profile file '%s': %s\n", path, strerror(errno));
+        return (false);
+    }
+
+    oc_arena_scope scratch = oc_scratch_begin();
+    bb_profile_list profiles = bb_program_collect_profiles(scratch.arena, factDb, cards, true);
+
+    fprintf(file, "card,rule,evaluations,factsScanned,matches,factsProduced,nanoseconds\n");
+    for(u32 i = 0; i < profiles.count; i++)
+    {
+        bb_profile_entry* entry = &profiles.entries[i];
+        bb_profile_counters* counters = &entry->profile->total;
+
+        //NOTE: quotes are doubled in csv fields
+        oc_str8 label = bb_profile_entry_label(scratch.arena, entry);
+        fprintf(file, "%u,\"", entry->card->id);
+        for(u64 charIndex = 0; charIndex < label.len; charIndex++)
+        {
+            if(label.ptr[charIndex] == '"')
+            {
+                fputc('"', file);
+            }
+            fputc(label.ptr[charIndex], file);
+        }
+        fprintf(file,
+                "\",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                counters->evaluations,
+                counters->factsScanned,
+                counters->matches,
+                counters->factsProduced,
+                counters->nanoseconds);
+    }
+
+    oc_scratch_end(scratch);
+    fclose(file);
+    return (true);
+}
+
+void bb_runner_print_usage(const char* name)
+{
+    printf("usage: %s [-f frames] [-w workers] [-n] [-m] [-p file] file...\n"
+           "  -f frames   number of frames to run (default 10)\n"
+           "  -w workers  number of workers evaluating cards, 0 for one per core (default 0)\n"
+           "  -n          rebuild the facts db from scratch each frame instead of updating it incrementally\n"
+           "  -m          move one card each frame, as if it was dragged around\n"
+           "  -p file     write the profiles of cards and whens over all frames to a csv file\n",
+           name);
+}
+
+int main(int argc, char** argv)
+{
+    u32 frameCount = 10;
+    u32 workerCount = 0;
+    bool incremental = true;
+    bool move = false;
+    const char* profilePath = 0;
+
+    int argIndex = 1;
+    for(; argIndex < argc && argv[argIndex][0] == '-'; argIndex++)
+    {
+        const char* arg = argv[argIndex];
+        if(!strcmp(arg, "-f") && argIndex + 1 < argc)
+        {
+            frameCount = strtoul(argv[++argIndex], 0, 10);
+        }
+        else if(!strcmp(arg, "-w") && argIndex + 1 < argc)
+        {
+            workerCount = strtoul(argv[++argIndex], 0, 10);
+        }
+        else if(!strcmp(arg, "-n"))
+        {
+            incremental = false;
+        }
+        else if(!strcmp(arg, "-m"))
+        {
+            move = true;
+        }
+        else if(!strcmp(arg, "-p") && argIndex + 1 < argc)
+        {
+            profilePath = argv[++argIndex];
+        }
+        else
+        {
+            bb_runner_print_usage(argv[0]);
+            return (-1);
+        }
+    }
+
+    u32 cardCount = argc - argIndex;
+    if(!cardCount)
+    {
+        bb_runner_print_usage(argv[0]);
+        return (-1);
+    }
+
+    oc_arena arena = { 0 };
+    oc_arena_init(&arena);
+
+    bb_facts_db factDb = {
+        .frame = 2,
+        .incremental = incremental,
+        .workerCount = workerCount,
+        .profiling = (profilePath != 0),
+    };
+    oc_arena_init(&factDb.persistentArena);
+
+    bb_program_init_builtin_listeners(&arena, &factDb);
+    bb_program_init_builtin_responders(&arena, &factDb);
+
+    //NOTE: lay out the cards on a square grid, close enough that whiskers reach the neighbouring cards
+    u32 columnCount = 1;
+    while(columnCount * columnCount < cardCount)
+    {
+        columnCount++;
+    }
+
+    bb_card* cards = oc_arena_push_array(&arena, bb_card, cardCount);
+    memset(cards, 0, cardCount * sizeof(bb_card));
+
+    oc_list activeList = { 0 };
+
+    for(u32 cardIndex = 0; cardIndex < cardCount; cardIndex++)
+    {
+        bb_card* card = &cards[cardIndex];
+        card->id = cardIndex + 1;
+        card->rect = (oc_rect){
+            (cardIndex % columnCount) * BB_RUNNER_CARD_SPACING,
+            (cardIndex / columnCount) * BB_RUNNER_CARD_SPACING,
+            BB_RUNNER_CARD_SIZE,
+            BB_RUNNER_CARD_SIZE,
+        };
+        card->displayRect = card->rect;
+
+        card->root = bb_runner_load_card_program(&arena, argv[argIndex + cardIndex]);
+        if(!card->root)
+        {
+            return (-1);
+        }
+        oc_list_push_back(&activeList, &card->listElt);
+    }
+
+    f64 totalDuration = 0;
+
+    for(u32 frameIndex = 0; frameIndex < frameCount; frameIndex++)
+    {
+        if(move && frameIndex)
+        {
+            //NOTE: move the cards in turn, back and forth, so that they stay around their place on the grid
+            bb_card* card = &cards[frameIndex % cardCount];
+            f32 step = ((frameIndex / cardCount) & 1) ? -BB_RUNNER_MOVE_STEP : BB_RUNNER_MOVE_STEP;
+            card->rect.x += step;
+            card->displayRect = card->rect;
+        }
+
+        oc_arena_scope scratch = oc_scratch_begin();
+
+        bb_program_stats stats = bb_program_update(scratch.arena, &factDb, activeList);
+        totalDuration += stats.duration;
+
+        printf("frame %" PRIu64 ": %" PRIu64 " iteration%s / %.3f ms, scanned %" PRIu64 " facts (skipped %" PRIu64 "), retracted %" PRIu64
+               " facts, evaluated %" PRIu64 " cards, %u facts\n",
+               stats.frame,
+               stats.iterations,
+               stats.iterations > 1 ? "s" : "",
+               stats.duration * 1000.,
+               stats.factsScanned,
+               stats.factsSkipped,
+               stats.factsRetracted,
+               stats.cardsEvaluated,
+               factDb.factCount);
+
+        if(frameIndex == frameCount - 1)
+        {
+            printf("facts:\n");
+
+            i32 factIndex = 0;
+            oc_list_for(factDb.facts, fact, bb_fact, listElt)
+            {
+                oc_str8 str = bb_debug_value_to_str8(scratch.arena, fact->root);
+                printf("  fact #%i: %.*s\n", factIndex, oc_str8_ip(str));
+                factIndex++;
+            }
+        }
+
+        oc_scratch_end(scratch);
+    }
+
+    bool profilesWritten = !profilePath || bb_runner_write_profiles(profilePath, &factDb, activeList);
+    bb_fact_db_cleanup(&factDb);
+    if(!profilesWritten)
+    {
+        return (-1);
+    }
+
+    if(frameCount)
+    {
+        printf("%u cards, %u frames, %.3f ms per frame\n", cardCount, frameCount, totalDuration * 1000. / frameCount);
+    }
+
+    return (0);
+}